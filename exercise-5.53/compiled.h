@@ -0,0 +1,94 @@
+/*
+ * Solution of SICP JS Exercise 5.53
+ *
+ * Copyright (c) 2025 Yuichiro MORIGUCHI
+ *
+ * This software is released under the MIT License.
+ * http://opensource.org/licenses/mit-license.php
+ **/
+
+/*
+ * What the C code emitted by compiler.c needs besides memory.h, which
+ * must be included first.  Compiled code runs on the registers, the
+ * stack and the trampoline of the machine in engine.c, so compiled,
+ * interpreted and primitive functions can call one another and call_cc
+ * captures them all alike.
+ */
+extern cell comp;
+extern cons *env;
+extern cell val;
+extern cont_type continuation;
+extern cell fun;
+extern int argc;
+extern cell unev;
+extern cont_type next;
+
+extern void apply_dispatch();
+extern void return_value();
+extern cell make_compiled_function(cont_type entry, cell parameters, cons *env);
+extern cons *extend_block_environment(cell names, cons *env);
+extern cell execute_compiled(cont_type entry, cell names);
+extern cell apply_operator(enum operator_code op, int argc, cell *argv);
+extern void enter_loop(cell loop);
+extern cons *loop_environment();
+extern void exit_loop();
+extern void unwind_loops(int count);
+
+/*
+ * Global bindings are looked up once and kept in a vector which the
+ * compiled program registers as a root.
+ */
+static inline cell global_binding(cell cache, int index, char *name) {
+    cell binding = vector_ref(cache, index);
+
+    if(is_null(binding)) {
+        binding = lookup_global_binding(get_symbol(name, strlen(name)), env);
+        vector_set(cache, index, binding);
+    }
+    return binding;
+}
+
+/*
+ * Operator names cannot be declared by a program, so an operator is
+ * always its primitive.  The inline results must be the ones the
+ * primitives in runtime.c give.
+ */
+static inline cell operator_value(enum operator_code op, cell left, cell right) {
+    cell operands[2];
+
+    if(op == EQUAL_OPERATOR) {
+        return get_number(eqv(left, right));
+    } else if(op == NOT_EQUAL_OPERATOR) {
+        return get_number(!eqv(left, right));
+    } else if(CELL_TYPE(left) != NUMBER || CELL_TYPE(right) != NUMBER) {
+        operands[0] = left;
+        operands[1] = right;
+        return apply_operator(op, 2, operands);
+    } else if(op == ADD_OPERATOR) {
+        return get_number(CELL_NUMBER(left) + CELL_NUMBER(right));
+    } else if(op == SUBTRACT_OPERATOR) {
+        return get_number(CELL_NUMBER(left) - CELL_NUMBER(right));
+    } else if(op == MULTIPLY_OPERATOR) {
+        return get_number(CELL_NUMBER(left) * CELL_NUMBER(right));
+    } else if(op == REMAINDER_OPERATOR) {
+        return get_number(fmod(CELL_NUMBER(left), CELL_NUMBER(right)));
+    } else if(op == LESS_THAN_OPERATOR) {
+        return get_number(CELL_NUMBER(left) < CELL_NUMBER(right));
+    } else if(op == LESS_THAN_EQUAL_OPERATOR) {
+        return get_number(!(CELL_NUMBER(left) > CELL_NUMBER(right)));
+    } else if(op == MORE_THAN_OPERATOR) {
+        return get_number(CELL_NUMBER(left) > CELL_NUMBER(right));
+    } else {
+        return get_number(!(CELL_NUMBER(left) < CELL_NUMBER(right)));
+    }
+}
+
+static inline cell unary_operator_value(enum operator_code op, cell operand) {
+    if(op == NOT_OPERATOR) {
+        return is_falsy(operand) ? get_true() : get_false();
+    } else if(CELL_TYPE(operand) == NUMBER) {
+        return get_number(-CELL_NUMBER(operand));
+    } else {
+        return apply_operator(op, 1, &operand);
+    }
+}
@@ -0,0 +1,722 @@
+/*
+ * Solution of SICP JS Exercise 5.53
+ *
+ * Copyright (c) 2025 Yuichiro MORIGUCHI
+ *
+ * This software is released under the MIT License.
+ * http://opensource.org/licenses/mit-license.php
+ **/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include "memory.h"
+
+/*
+ * Compiles a program into a C translation unit in the manner of SICP
+ * 5.5.  The analyzed program is translated into instruction sequences
+ * of C statements, each recording the registers it needs and modifies,
+ * so that preserving saves a register around a sequence only when the
+ * sequence modifies it and the one that follows needs it.
+ *
+ * Each label starts a C function.  A jump to a label is a call of its
+ * function when it goes forward, while the jump back to the test of a
+ * loop, returns and calls of functions go through the trampoline of
+ * engine.c with the protocol of the evaluator, so that the C stack does
+ * not grow with recursion, the collector runs between steps and call_cc
+ * works across compiled and interpreted code.  Expressions which need no
+ * call are computed in a single C expression.  The unit is built with
+ * the other sources except main.c:
+ *
+ *     sicp --compile "$(cat prog.js)" > prog.c
+ *     cc -O2 -I. prog.c engine.c memory.c runtime.c parser.c rules.tab.c -lm -lpthread
+ */
+#define ENV_REGISTER 1
+#define VAL_REGISTER 2
+#define CONTINUATION_REGISTER 4
+#define ALL_REGISTERS 7
+
+#define NEXT_LINKAGE NULL
+
+typedef struct code_tag {
+    int needs;
+    int modifies;
+    char *text;
+} code;
+
+typedef struct string_list_tag {
+    char **strings;
+    int count;
+    int size;
+} string_list;
+
+static char return_linkage[] = "return";
+static int label_count = 0;
+static string_list constants;
+static string_list global_names;
+static string_list functions;
+static char *break_label = NULL;
+static char *continue_label = NULL;
+
+static char *operator_names[OPERATORS] = {
+    "ADD_OPERATOR",
+    "SUBTRACT_OPERATOR",
+    "MULTIPLY_OPERATOR",
+    "REMAINDER_OPERATOR",
+    "EQUAL_OPERATOR",
+    "NOT_EQUAL_OPERATOR",
+    "LESS_THAN_OPERATOR",
+    "LESS_THAN_EQUAL_OPERATOR",
+    "MORE_THAN_OPERATOR",
+    "MORE_THAN_EQUAL_OPERATOR",
+    "NEGATE_OPERATOR",
+    "NOT_OPERATOR"
+};
+
+static char *vformat(char *fmt, va_list args) {
+    va_list copy;
+    char *result;
+    int length;
+
+    va_copy(copy, args);
+    length = vsnprintf(NULL, 0, fmt, copy);
+    va_end(copy);
+    if((result = malloc(length + 1)) == NULL) {
+        PUT_ERROR("Out of memory -- vformat", get_nil());
+    }
+    vsnprintf(result, length + 1, fmt, args);
+    return result;
+}
+
+static char *format(char *fmt, ...) {
+    va_list args;
+    char *result;
+
+    va_start(args, fmt);
+    result = vformat(fmt, args);
+    va_end(args);
+    return result;
+}
+
+static int add_string(string_list *list, char *string) {
+    if(list->count >= list->size) {
+        list->size = list->size == 0 ? 64 : list->size * 2;
+        if((list->strings = realloc(list->strings, list->size * sizeof(char *))) == NULL) {
+            PUT_ERROR("Out of memory -- add_string", get_nil());
+        }
+    }
+    list->strings[list->count] = string;
+    return list->count++;
+}
+
+static int string_index(string_list *list, char *string) {
+    int i;
+
+    for(i = 0; i < list->count; i++) {
+        if(strcmp(list->strings[i], string) == 0) {
+            return i;
+        }
+    }
+    return add_string(list, string);
+}
+
+static char *c_string(char *chars, long length) {
+    char *result = malloc(length * 4 + 3);
+    char *dst = result;
+    long i;
+
+    if(result == NULL) {
+        PUT_ERROR("Out of memory -- c_string", get_nil());
+    }
+    *dst++ = '"';
+    for(i = 0; i < length; i++) {
+        if(chars[i] == '"' || chars[i] == '\\') {
+            *dst++ = '\\';
+            *dst++ = chars[i];
+        } else if(isprint((unsigned char)chars[i])) {
+            *dst++ = chars[i];
+        } else {
+            dst += sprintf(dst, "\\%03o", (unsigned char)chars[i]);
+        }
+    }
+    *dst++ = '"';
+    *dst = '\0';
+    return result;
+}
+
+/*
+ * Instruction sequences.  The text holds one C statement per line, and
+ * a line starting with @ is a label.
+ */
+static code make_code(int needs, int modifies, char *text) {
+    code result;
+
+    result.needs = needs;
+    result.modifies = modifies;
+    result.text = text;
+    return result;
+}
+
+static code empty_code() {
+    return make_code(0, 0, format(""));
+}
+
+static code statement(int needs, int modifies, char *fmt, ...) {
+    va_list args;
+    char *text;
+    code result;
+
+    va_start(args, fmt);
+    text = vformat(fmt, args);
+    va_end(args);
+    result = make_code(needs, modifies, format("%s\n", text));
+    free(text);
+    return result;
+}
+
+static char *make_label(char *name) {
+    return format("%s_%d", name, ++label_count);
+}
+
+static code label_code(char *label) {
+    return make_code(0, 0, format("@%s\n", label));
+}
+
+static code append_code(code first, code second) {
+    code result = make_code(first.needs | (second.needs & ~first.modifies),
+                            first.modifies | second.modifies,
+                            format("%s%s", first.text, second.text));
+
+    free(first.text);
+    free(second.text);
+    return result;
+}
+
+static code parallel_code(code first, code second) {
+    code result = make_code(first.needs | second.needs,
+                            first.modifies | second.modifies,
+                            format("%s%s", first.text, second.text));
+
+    free(first.text);
+    free(second.text);
+    return result;
+}
+
+static char *save_statement(int reg) {
+    return reg == ENV_REGISTER ? "save_cons(env);"
+           : reg == CONTINUATION_REGISTER ? "save_continuation(continuation);"
+           : "save(val);";
+}
+
+static char *restore_statement(int reg) {
+    return reg == ENV_REGISTER ? "env = restore_cons();"
+           : reg == CONTINUATION_REGISTER ? "continuation = restore_continuation();"
+           : "val = restore();";
+}
+
+static code preserving(int registers, code first, code second) {
+    int reg;
+    char *text;
+
+    for(reg = 1; reg <= ALL_REGISTERS; reg <<= 1) {
+        if((registers & reg) && (second.needs & reg) && (first.modifies & reg)) {
+            text = format("%s\n%s%s\n", save_statement(reg), first.text, restore_statement(reg));
+            free(first.text);
+            first = make_code(first.needs | reg, first.modifies & ~reg, text);
+        }
+    }
+    return append_code(first, second);
+}
+
+static char *jump(char *linkage) {
+    return linkage == return_linkage
+           ? format("next = continuation; return;")
+           : format("%s(); return;", linkage);
+}
+
+static code compile_linkage(char *linkage) {
+    return linkage == NEXT_LINKAGE
+           ? empty_code()
+           : statement(linkage == return_linkage ? CONTINUATION_REGISTER : 0, 0, "%s", jump(linkage));
+}
+
+static code end_with_linkage(char *linkage, code sequence) {
+    return preserving(CONTINUATION_REGISTER, sequence, compile_linkage(linkage));
+}
+
+/*
+ * Values which live in the heap are made once when the compiled program
+ * starts and kept in a vector registered as a root.
+ */
+static char *constant_expression(char *initializer) {
+    return format("vector_ref(constants, %d)", add_string(&constants, initializer));
+}
+
+static char *symbol_list_initializer(cell symbols) {
+    cell symbol;
+    symbol_view view;
+
+    if(is_null(symbols)) {
+        return format("get_nil()");
+    } else {
+        symbol = head(symbols);
+        view = get_symbol_view(&symbol);
+        return format("pair(get_symbol(%s, %ld), %s)", c_string(view.chars, view.length), view.length,
+                      symbol_list_initializer(tail(symbols)));
+    }
+}
+
+static char *literal_expression(cell value) {
+    symbol_view view;
+
+    if(CELL_TYPE(value) == NUMBER) {
+        return format("get_number(%.17g)", CELL_NUMBER(value));
+    } else if(is_null(value)) {
+        return format("get_nil()");
+    } else if(CELL_TYPE(value) == TRUE_LITERAL) {
+        return format("get_true()");
+    } else if(CELL_TYPE(value) == FALSE_LITERAL) {
+        return format("get_false()");
+    } else if(CELL_TYPE(value) == UNDEFINED) {
+        return format("get_undefined()");
+    } else if(is_string(value)) {
+        view = get_symbol_view(&value);
+        return constant_expression(format("get_string(%s, %ld)", c_string(view.chars, view.length), view.length));
+    } else {
+        PUT_ERROR("Unknown literal -- literal_expression", value);
+    }
+}
+
+static char *global_binding_expression(cell symbol) {
+    symbol_view view = get_symbol_view(&symbol);
+    char *name = c_string(view.chars, view.length);
+
+    return format("global_binding(bindings, %d, %s)", string_index(&global_names, name), name);
+}
+
+/*
+ * The nodes are the ones made by the analysis in engine.c.
+ */
+static cell node_child(cell node, int index) {
+    return vector_ref(node, index);
+}
+
+static int node_int(cell node, int index) {
+    return check_and_get_int(vector_ref(node, index));
+}
+
+static int is_unary_operator_node(cell node) {
+    return vector_length(node) == 3;
+}
+
+static int list_count(cell list) {
+    return is_null(list) ? 0 : 1 + list_count(tail(list));
+}
+
+static code compile(cell node, char *linkage);
+
+static int is_simple(cell node) {
+    int kind = vector_kind(node);
+
+    return kind == LITERAL_NODE || kind == NAME_NODE || kind == LAMBDA_NODE ||
+           (kind == OPERATOR_NODE && is_simple(node_child(node, 2)) &&
+            (is_unary_operator_node(node) || is_simple(node_child(node, 3))));
+}
+
+static int expression_needs(cell node) {
+    int kind = vector_kind(node);
+
+    return kind == LITERAL_NODE
+           ? 0
+           : kind != OPERATOR_NODE
+           ? ENV_REGISTER
+           : is_unary_operator_node(node)
+           ? expression_needs(node_child(node, 2))
+           : expression_needs(node_child(node, 2)) | expression_needs(node_child(node, 3));
+}
+
+static char *name_expression(cell node) {
+    int depth = node_int(node, 1);
+
+    return depth < 0
+           ? format("tail(%s)", global_binding_expression(node_child(node, 0)))
+           : format("lookup_lexical_value(%d, %d, env)", depth, node_int(node, 2));
+}
+
+static code return_undefined_code() {
+    return statement(0, ALL_REGISTERS,
+                     "revert_stack_to_marker();\n"
+                     "continuation = restore_continuation();\n"
+                     "val = get_undefined();\n"
+                     "next = continuation; return;");
+}
+
+/*
+ * The body of a function is compiled into functions of its own, entered
+ * through compiled_apply in engine.c with the frame extended and the
+ * marker pushed.
+ */
+static char *compile_lambda(cell node) {
+    char *entry = make_label("entry");
+    code body = label_code(entry);
+
+    body = append_code(body, compile(node_child(node, 1), NEXT_LINKAGE));
+    body = append_code(body, return_undefined_code());
+    add_string(&functions, body.text);
+    return format("make_compiled_function(%s, %s, env)",
+                  entry, constant_expression(symbol_list_initializer(node_child(node, 0))));
+}
+
+static char *expression(cell node) {
+    int kind = vector_kind(node);
+    char *first;
+
+    if(kind == LITERAL_NODE) {
+        return literal_expression(node_child(node, 0));
+    } else if(kind == NAME_NODE) {
+        return name_expression(node);
+    } else if(kind == LAMBDA_NODE) {
+        return compile_lambda(node);
+    } else if(is_unary_operator_node(node)) {
+        return format("unary_operator_value(%s, %s)",
+                      operator_names[node_int(node, 1)], expression(node_child(node, 2)));
+    } else {
+        first = expression(node_child(node, 2));
+        return format("operator_value(%s, %s, %s)",
+                      operator_names[node_int(node, 1)], first, expression(node_child(node, 3)));
+    }
+}
+
+static code compile_operator(cell node, char *linkage) {
+    char *op = operator_names[node_int(node, 1)];
+    cell second = is_unary_operator_node(node) ? get_nil() : node_child(node, 3);
+    code first = compile(node_child(node, 2), NEXT_LINKAGE);
+    code rest;
+
+    if(is_unary_operator_node(node)) {
+        rest = statement(VAL_REGISTER, VAL_REGISTER, "val = unary_operator_value(%s, val);", op);
+    } else if(is_simple(second)) {
+        rest = statement(VAL_REGISTER | expression_needs(second), VAL_REGISTER,
+                         "val = operator_value(%s, val, %s);", op, expression(second));
+    } else {
+        rest = statement(VAL_REGISTER, 0, "save(val);");
+        rest = append_code(rest, compile(second, NEXT_LINKAGE));
+        rest = append_code(rest, statement(VAL_REGISTER, VAL_REGISTER, "val = operator_value(%s, restore(), val);", op));
+    }
+    return end_with_linkage(linkage, preserving(ENV_REGISTER, first, rest));
+}
+
+/*
+ * An application follows the protocol of the evaluator: the return
+ * address is pushed below the function and the arguments, and whoever
+ * applies the function pops them all and goes to that address with the
+ * result in val.  A primitive is applied right here; anything else is
+ * left to apply_dispatch.
+ */
+static code compile_operands(cell operands) {
+    cell operand = head(operands);
+    code first = is_simple(operand) ? empty_code() : compile(operand, NEXT_LINKAGE);
+    code rest = is_simple(operand)
+                ? statement(expression_needs(operand), 0, "save(%s);", expression(operand))
+                : statement(VAL_REGISTER, 0, "save(val);");
+
+    if(!is_null(tail(operands))) {
+        rest = append_code(rest, compile_operands(tail(operands)));
+    }
+    return preserving(ENV_REGISTER, first, rest);
+}
+
+static code compile_call(int count, char *return_to) {
+    code result = statement(0, ALL_REGISTERS,
+                            "fun = stack_arguments(%d)[0];\n"
+                            "if(!is_primitive_function(fun)) { argc = %d; next = apply_dispatch; return; }\n"
+                            "val = apply_primitive_function(fun, %d, stack_arguments(%d));",
+                            count + 1, count, count, count);
+
+    return append_code(result, return_to == return_linkage
+                               ? statement(0, CONTINUATION_REGISTER,
+                                           "drop_stack(%d);\n"
+                                           "continuation = restore_continuation();\n"
+                                           "next = continuation; return;", count + 1)
+                               : statement(0, 0, "drop_stack(%d);\n%s(); return;", count + 2, return_to));
+}
+
+static code compile_application(cell node, char *linkage) {
+    cell operands = pair(node_child(node, 0), node_child(node, 1));
+    char *after = linkage == NEXT_LINKAGE ? make_label("after_call") : NULL;
+    char *return_to = after != NULL ? after : linkage;
+    code result = return_to == return_linkage
+                  ? statement(CONTINUATION_REGISTER, 0, "save_continuation(continuation);")
+                  : statement(0, 0, "save_continuation(%s);", return_to);
+
+    result = append_code(result, compile_operands(operands));
+    result = append_code(result, compile_call(list_count(operands) - 1, return_to));
+    return after != NULL ? append_code(result, label_code(after)) : result;
+}
+
+static code compile_logical(cell node, char *linkage) {
+    char *after = linkage == NEXT_LINKAGE ? make_label("after_logical") : NULL;
+    char *done = after != NULL ? after : linkage;
+    code first = compile(node_child(node, 0), NEXT_LINKAGE);
+    code rest = statement(VAL_REGISTER | (done == return_linkage ? CONTINUATION_REGISTER : 0), 0,
+                          "if(%sis_falsy(val)) { %s }",
+                          vector_kind(node) == AND_NODE ? "" : "!", jump(done));
+
+    rest = append_code(rest, compile(node_child(node, 1), linkage));
+    if(after != NULL) {
+        rest = append_code(rest, label_code(after));
+    }
+    return preserving(ENV_REGISTER | CONTINUATION_REGISTER, first, rest);
+}
+
+static code compile_conditional(cell node, char *linkage) {
+    cell predicate = node_child(node, 0);
+    char *false_branch = make_label("false_branch");
+    char *after = linkage == NEXT_LINKAGE ? make_label("after_conditional") : NULL;
+    code test = is_simple(predicate) ? empty_code() : compile(predicate, NEXT_LINKAGE);
+    code branches = is_simple(predicate)
+                    ? statement(expression_needs(predicate), 0, "if(is_falsy(%s)) { %s(); return; }",
+                                expression(predicate), false_branch)
+                    : statement(VAL_REGISTER, 0, "if(is_falsy(val)) { %s(); return; }", false_branch);
+    code consequent = compile(node_child(node, 1), after != NULL ? after : linkage);
+    code alternative = append_code(label_code(false_branch), compile(node_child(node, 2), linkage));
+
+    branches = append_code(branches, parallel_code(consequent, alternative));
+    if(after != NULL) {
+        branches = append_code(branches, label_code(after));
+    }
+    return preserving(ENV_REGISTER | CONTINUATION_REGISTER, test, branches);
+}
+
+static code compile_sequence(cell statements, char *linkage) {
+    code first;
+
+    if(is_null(statements)) {
+        return end_with_linkage(linkage, statement(0, VAL_REGISTER, "val = get_undefined();"));
+    } else if(is_null(tail(statements))) {
+        return compile(head(statements), linkage);
+    } else {
+        first = compile(head(statements), NEXT_LINKAGE);
+        return preserving(ENV_REGISTER | CONTINUATION_REGISTER, first, compile_sequence(tail(statements), linkage));
+    }
+}
+
+static code compile_block(cell node, char *linkage) {
+    code result = statement(ENV_REGISTER, ENV_REGISTER, "env = extend_block_environment(%s, env);",
+                            constant_expression(symbol_list_initializer(node_child(node, 0))));
+
+    return append_code(result, compile(node_child(node, 1), linkage));
+}
+
+/*
+ * A loop runs in the frame pushed by enter_loop in engine.c, which gives
+ * back the environment and the continuation it was entered with when the
+ * loop is left, by its test or by a break.
+ */
+static code compile_loop(cell node, char *linkage) {
+    cell predicate = node_child(node, 0);
+    cell update = node_child(node, 2);
+    char *test = make_label("loop_test");
+    char *update_label = make_label("loop_update");
+    char *exit = make_label("loop_exit");
+    char *outer_break = break_label;
+    char *outer_continue = continue_label;
+    code result = statement(ENV_REGISTER | CONTINUATION_REGISTER, 0, "enter_loop(get_nil());");
+
+    result = append_code(result, label_code(test));
+    result = append_code(result, statement(0, ENV_REGISTER, "env = loop_environment();"));
+    if(is_simple(predicate)) {
+        result = append_code(result, statement(expression_needs(predicate), 0, "if(is_falsy(%s)) { %s(); return; }",
+                                                expression(predicate), exit));
+    } else {
+        result = append_code(result, compile(predicate, NEXT_LINKAGE));
+        result = append_code(result, statement(VAL_REGISTER, 0, "if(is_falsy(val)) { %s(); return; }", exit));
+    }
+    break_label = exit;
+    continue_label = update_label;
+    result = append_code(result, compile(node_child(node, 1), NEXT_LINKAGE));
+    break_label = outer_break;
+    continue_label = outer_continue;
+    result = append_code(result, label_code(update_label));
+    result = append_code(result, statement(0, ENV_REGISTER, "env = loop_environment();"));
+    if(!is_null(update)) {
+        result = append_code(result, compile(update, NEXT_LINKAGE));
+    }
+    result = append_code(result, statement(0, 0, "next = %s; return;", test));
+    result = append_code(result, label_code(exit));
+    result = append_code(result, statement(0, ALL_REGISTERS, "exit_loop();"));
+    result.needs = ENV_REGISTER | CONTINUATION_REGISTER;
+    result.modifies = VAL_REGISTER;
+    return end_with_linkage(linkage, result);
+}
+
+/*
+ * A simple value is returned right away.  Anything else is computed with
+ * return_value of engine.c as its continuation, so that a call in it is
+ * a tail call which keeps the frame, as in the evaluator.
+ */
+static code compile_return(cell node) {
+    int loops = node_int(node, 1);
+    code result = is_simple(node_child(node, 0))
+                  ? statement(0, CONTINUATION_REGISTER,
+                              "revert_stack_to_marker();\n"
+                              "continuation = restore_continuation();")
+                  : statement(0, CONTINUATION_REGISTER,
+                              "drop_stack_to_marker();\n"
+                              "continuation = return_value;");
+
+    if(loops > 0) {
+        result = append_code(statement(0, 0, "unwind_loops(%d);", loops), result);
+    }
+    return append_code(result, compile(node_child(node, 0), return_linkage));
+}
+
+static code compile_definition(cell node, char *linkage) {
+    int depth = node_int(node, 1);
+    code value = compile(node_child(node, 3), NEXT_LINKAGE);
+    char *assign = depth < 0
+                   ? format("set_tail(%s, val);", global_binding_expression(node_child(node, 0)))
+                   : format("assign_lexical_value(%d, %d, val, env);", depth, node_int(node, 2));
+    code result = vector_kind(node) == DECLARATION_NODE
+                  ? statement(ENV_REGISTER | VAL_REGISTER, VAL_REGISTER, "%s\nval = get_undefined();", assign)
+                  : statement(ENV_REGISTER | VAL_REGISTER, 0, "%s", assign);
+
+    return end_with_linkage(linkage, preserving(ENV_REGISTER, value, result));
+}
+
+static code compile(cell node, char *linkage) {
+    int kind = vector_kind(node);
+
+    if(is_simple(node)) {
+        return end_with_linkage(linkage, statement(expression_needs(node), VAL_REGISTER, "val = %s;", expression(node)));
+    } else if(kind == APPLICATION_NODE) {
+        return compile_application(node, linkage);
+    } else if(kind == OPERATOR_NODE) {
+        return compile_operator(node, linkage);
+    } else if(kind == AND_NODE || kind == OR_NODE) {
+        return compile_logical(node, linkage);
+    } else if(kind == CONDITIONAL_NODE) {
+        return compile_conditional(node, linkage);
+    } else if(kind == SEQUENCE_NODE) {
+        return compile_sequence(node_child(node, 0), linkage);
+    } else if(kind == BLOCK_NODE) {
+        return compile_block(node, linkage);
+    } else if(kind == RETURN_NODE) {
+        return compile_return(node);
+    } else if(kind == DECLARATION_NODE || kind == ASSIGNMENT_NODE) {
+        return compile_definition(node, linkage);
+    } else if(kind == LOOP_NODE) {
+        return compile_loop(node, linkage);
+    } else if(kind == BREAK_NODE) {
+        return statement(0, 0, "%s(); return;", break_label);
+    } else if(kind == CONTINUE_NODE) {
+        return statement(0, 0, "drop_stack_to_marker();\n%s(); return;", continue_label);
+    } else {
+        PUT_ERROR("Unknown node -- compile", get_number(kind));
+    }
+}
+
+/*
+ * Writes each label as a C function.  Code running into the next label
+ * calls it.
+ */
+static void emit_declarations(char *text, FILE *out) {
+    char *end;
+
+    for(; *text != '\0'; text = end + 1) {
+        end = strchr(text, '\n');
+        if(*text == '@') {
+            fprintf(out, "static void %.*s();\n", (int)(end - text - 1), text + 1);
+        }
+    }
+}
+
+static void emit_functions(char *text, FILE *out) {
+    char *end;
+    int in_function = FALSE;
+    int jumped = FALSE;
+
+    for(; *text != '\0'; text = end + 1) {
+        end = strchr(text, '\n');
+        if(*text != '@') {
+            fprintf(out, "    %.*s\n", (int)(end - text), text);
+            jumped = end - text >= 7 && strncmp(end - 7, "return;", 7) == 0;
+        } else {
+            if(in_function) {
+                if(!jumped) {
+                    fprintf(out, "    %.*s();\n", (int)(end - text - 1), text + 1);
+                }
+                fprintf(out, "}\n\n");
+            }
+            fprintf(out, "static void %.*s() {\n", (int)(end - text - 1), text + 1);
+            in_function = TRUE;
+            jumped = FALSE;
+        }
+    }
+    if(in_function) {
+        fprintf(out, "}\n\n");
+    }
+}
+
+static void emit_program(char *text, int names, FILE *out) {
+    int i;
+
+    fprintf(out, "/*\n * Compiled by sicp --compile.\n */\n");
+    fprintf(out, "#include <stdio.h>\n#include <stdlib.h>\n#include <string.h>\n#include <math.h>\n");
+    fprintf(out, "#include \"memory.h\"\n#include \"compiled.h\"\n\n");
+    fprintf(out, "static cell constants;\nstatic cell bindings;\n\n");
+    emit_declarations(text, out);
+    for(i = 0; i < functions.count; i++) {
+        emit_declarations(functions.strings[i], out);
+    }
+    fprintf(out, "\n");
+    emit_functions(text, out);
+    for(i = 0; i < functions.count; i++) {
+        emit_functions(functions.strings[i], out);
+    }
+    fprintf(out, "static void init_constants() {\n");
+    fprintf(out, "    int i;\n\n");
+    fprintf(out, "    constants = make_vector(TABLE_VECTOR, %d);\n", constants.count);
+    for(i = 0; i < constants.count; i++) {
+        fprintf(out, "    vector_set(constants, %d, %s);\n", i, constants.strings[i]);
+    }
+    fprintf(out, "    bindings = make_vector(TABLE_VECTOR, %d);\n", global_names.count + 1);
+    fprintf(out, "    for(i = 0; i < %d; i++) {\n", global_names.count + 1);
+    fprintf(out, "        vector_set(bindings, i, get_nil());\n");
+    fprintf(out, "    }\n");
+    fprintf(out, "}\n\n");
+    fprintf(out, "static cell push_constants() {\n    return constants;\n}\n\n");
+    fprintf(out, "static cell push_bindings() {\n    return bindings;\n}\n\n");
+    fprintf(out, "static void relocate_constants(cell c) {\n    constants = c;\n}\n\n");
+    fprintf(out, "static void relocate_bindings(cell c) {\n    bindings = c;\n}\n\n");
+    fprintf(out, "int main(int argc, char **argv) {\n");
+    fprintf(out, "    int i;\n\n");
+    fprintf(out, "    for(i = 1; i < argc; i++) {\n");
+    fprintf(out, "        if(!set_gc_option(argv[i])) {\n");
+    fprintf(out, "            fprintf(stderr, \"usage: %%s [--gc=copying|generational|incremental|parallel|compact] [--gc-threads=N]\\n\", argv[0]);\n");
+    fprintf(out, "            exit(1);\n");
+    fprintf(out, "        }\n");
+    fprintf(out, "    }\n");
+    fprintf(out, "    init_memory();\n");
+    fprintf(out, "    init_cons();\n");
+    fprintf(out, "    init_constants();\n");
+    fprintf(out, "    add_register(push_constants, relocate_constants);\n");
+    fprintf(out, "    add_register(push_bindings, relocate_bindings);\n");
+    fprintf(out, "    display(execute_compiled(program_entry, vector_ref(constants, %d)));\n", names);
+    fprintf(out, "    return 0;\n");
+    fprintf(out, "}\n");
+}
+
+extern void compile_program(char *program, FILE *out) {
+    cell parsed = parse_js_bison(program);
+    int names;
+    code body;
+
+    if(is_null(parsed)) {
+        PUT_ERROR("Syntax error -- compile_program", get_nil());
+    }
+    names = add_string(&constants, symbol_list_initializer(program_declarations(parsed)));
+    body = append_code(label_code("program_entry"), compile(analyze_program(parsed), return_linkage));
+    emit_program(body.text, names, out);
+}
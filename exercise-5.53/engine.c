@@ -9,31 +9,91 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include "memory.h"
+#include "compiled.h"
 
-static cell comp;
-static cons *env;
-static cell val;
-static cont_type continuation;
-static cell fun;
-static cell argl;
-static cell unev;
-static cont_type next;
+cell comp;
+cons *env;
+cell val;
+cont_type continuation;
+cell fun;
+int argc;
+cell unev;
+cont_type next;
 
-static char *symbol_of_name(cell c) {
-    return check_and_get_symbol(head(tail(c)));
-}
-
-static int is_tagged_list(cell component, char *tag) {
-    return is_pair(component) && equal_symbol(head(component), tag);
+/*
+ * Tags of the syntax lists, interned once by init_tags so that a tag
+ * test is a single comparison.
+ */
+static cell literal_tag;
+static cell application_tag;
+static cell compound_function_tag;
+static cell compiled_function_tag;
+static cell cont_tag;
+static cell esc_tag;
+static cell unary_operator_combination_tag;
+static cell binary_operator_combination_tag;
+static cell lambda_expression_tag;
+static cell sequence_tag;
+static cell block_tag;
+static cell function_declaration_tag;
+static cell constant_declaration_tag;
+static cell variable_declaration_tag;
+static cell return_statement_tag;
+static cell name_tag;
+static cell conditional_expression_tag;
+static cell conditional_statement_tag;
+static cell assignment_tag;
+static cell logical_composition_tag;
+static cell while_loop_tag;
+static cell for_loop_tag;
+static cell break_statement_tag;
+static cell continue_statement_tag;
+static cell unassigned_value;
+
+static void init_tags() {
+    literal_tag = get_permanent_symbol("literal");
+    application_tag = get_permanent_symbol("application");
+    compound_function_tag = get_permanent_symbol("compound_function");
+    compiled_function_tag = get_permanent_symbol("compiled_function");
+    cont_tag = get_permanent_symbol("%cont");
+    esc_tag = get_permanent_symbol("%esc");
+    unary_operator_combination_tag = get_permanent_symbol("unary_operator_combination");
+    binary_operator_combination_tag = get_permanent_symbol("binary_operator_combination");
+    lambda_expression_tag = get_permanent_symbol("lambda_expression");
+    sequence_tag = get_permanent_symbol("sequence");
+    block_tag = get_permanent_symbol("block");
+    function_declaration_tag = get_permanent_symbol("function_declaration");
+    constant_declaration_tag = get_permanent_symbol("constant_declaration");
+    variable_declaration_tag = get_permanent_symbol("variable_declaration");
+    return_statement_tag = get_permanent_symbol("return_statement");
+    name_tag = get_permanent_symbol("name");
+    conditional_expression_tag = get_permanent_symbol("conditional_expression");
+    conditional_statement_tag = get_permanent_symbol("conditional_statement");
+    assignment_tag = get_permanent_symbol("assignment");
+    logical_composition_tag = get_permanent_symbol("logical_composition");
+    while_loop_tag = get_permanent_symbol("while_loop");
+    for_loop_tag = get_permanent_symbol("for_loop");
+    break_statement_tag = get_permanent_symbol("break_statement");
+    continue_statement_tag = get_permanent_symbol("continue_statement");
+    unassigned_value = get_permanent_symbol("*unassigned*");
+}
+
+static cell symbol_of_name(cell c) {
+    return head(tail(c));
+}
+
+static int is_tagged_list(cell component, cell tag) {
+    return is_pair(component) && eq_symbol(head(component), tag);
 }
 
 static int is_literal(cell component) {
-    return is_tagged_list(component, "literal");
+    return is_tagged_list(component, literal_tag);
 }
 
 extern cell make_literal(cell value) {
-    return pair(get_symbol_len("literal"), pair(value, get_nil()));
+    return pair(literal_tag, pair(value, get_nil()));
 }
 
 static cell literal_value(cell component) {
@@ -41,12 +101,12 @@ static cell literal_value(cell component) {
 }
 
 extern cell make_application(cell function_expression, cell argument_expressions) {
-    return pair(get_symbol_len("application"),
+    return pair(application_tag,
                 pair(function_expression, pair(argument_expressions, get_nil())));
 }
 
 static cell make_function(cell parameters, cell body, cons *env) {
-    return pair(get_symbol_len("compound_function"),
+    return pair(compound_function_tag,
                 pair(parameters,
                      pair(body,
                           pair(get_pointer(env),
@@ -54,7 +114,7 @@ static cell make_function(cell parameters, cell body, cons *env) {
 }
 
 static int is_compound_function(cell component) {
-    return is_tagged_list(component, "compound_function");
+    return is_tagged_list(component, compound_function_tag);
 }
 
 static cell function_parameters(cell component) {
@@ -66,56 +126,80 @@ static cell function_body(cell component) {
 }
 
 static cons *function_environment(cell component) {
-    return head(tail(tail(tail(component)))).datum.ptr;
+    return CELL_POINTER(head(tail(tail(tail(component)))));
+}
+
+/*
+ * A compiled function has the layout of a compound function with the
+ * entry of its compiled body in place of the body.
+ */
+extern cell make_compiled_function(cont_type entry, cell parameters, cons *env) {
+    return pair(compiled_function_tag,
+                pair(parameters,
+                     pair(get_continuation(entry),
+                          pair(get_pointer(env),
+                               get_nil()))));
+}
+
+static int is_compiled_function(cell component) {
+    return is_tagged_list(component, compiled_function_tag);
+}
+
+static cont_type compiled_function_entry(cell component) {
+    return check_and_get_continuation(function_body(component));
 }
 
 static int is_continuation(cell component) {
-    return is_tagged_list(component, "%cont");
+    return is_tagged_list(component, cont_tag);
 }
 
 static cell continuation_registers(cell component) {
     return head(tail(component));
 }
 
+static int is_escape(cell component) {
+    return is_tagged_list(component, esc_tag);
+}
+
 static int is_application(cell component) {
-    return is_tagged_list(component, "application");
+    return is_tagged_list(component, application_tag);
 }
 
 static int is_unary_operator_combination(cell component) {
-    return is_tagged_list(component, "unary_operator_combination");
+    return is_tagged_list(component, unary_operator_combination_tag);
 }
 
 extern cell make_unary_operator_combination(char *operator, cell expression) {
-    return pair(get_symbol_len("unary_operator_combination"),
+    return pair(unary_operator_combination_tag,
                 pair(get_symbol_len(operator), pair(expression, get_nil())));
 }
 
 extern cell make_binary_operator_combination(char *operator, cell expression1, cell expression2) {
-    return pair(get_symbol_len("binary_operator_combination"),
+    return pair(binary_operator_combination_tag,
                 pair(get_symbol_len(operator), pair(expression1, pair(expression2, get_nil()))));
 }
 
 static int is_operator_combination(cell component) {
     return is_unary_operator_combination(component) ||
-           is_tagged_list(component, "binary_operator_combination");
+           is_tagged_list(component, binary_operator_combination_tag);
 }
 
 static int is_lambda_expression(cell component) {
-    return is_tagged_list(component, "lambda_expression");
+    return is_tagged_list(component, lambda_expression_tag);
 }
 
 extern cell make_lambda_expression(cell params, cell body) {
-    return pair(get_symbol_len("lambda_expression"),
+    return pair(lambda_expression_tag,
                 pair(params,
                      pair(body, get_nil())));
 }
 
 static int is_sequence(cell component) {
-    return is_tagged_list(component, "sequence");
+    return is_tagged_list(component, sequence_tag);
 }
 
 extern cell make_sequence(cell seq) {
-    return pair(get_symbol_len("sequence"), pair(seq, get_nil()));
+    return pair(sequence_tag, pair(seq, get_nil()));
 }
 
 static cell sequence_statements(cell component) {
@@ -123,11 +207,11 @@ static cell sequence_statements(cell component) {
 }
 
 extern cell make_block(cell statements) {
-    return pair(get_symbol_len("block"), pair(statements, get_nil()));
+    return pair(block_tag, pair(statements, get_nil()));
 }
 
 static int is_block(cell component) {
-    return is_tagged_list(component, "block");
+    return is_tagged_list(component, block_tag);
 }
 
 static cell block_body(cell component) {
@@ -139,12 +223,12 @@ static cell scan_out_declarations(cell component);
 static cell list_of_unassigned(cell symbols) {
     return is_null(symbols)
            ? get_nil()
-           : pair(get_symbol_len("*unassigned*"),
+           : pair(unassigned_value,
                   list_of_unassigned(tail(symbols)));
 }
 
 static int is_function_declaration(cell component) {
-    return is_tagged_list(component, "function_declaration");
+    return is_tagged_list(component, function_declaration_tag);
 }
 
 static cell function_declaration_name(cell component) {
@@ -160,25 +244,25 @@ static cell function_declaration_body(cell component) {
 }
 
 static int is_declaration(cell component) {
-    return is_tagged_list(component, "constant_declaration") ||
-           is_tagged_list(component, "variable_declaration") ||
+    return is_tagged_list(component, constant_declaration_tag) ||
+           is_tagged_list(component, variable_declaration_tag) ||
            is_function_declaration(component);
 }
 
 extern cell make_constant_declaration(cell name, cell value) {
-    return pair(get_symbol_len("constant_declaration"),
+    return pair(constant_declaration_tag,
                 pair(name,
                      pair(value, get_nil())));
 }
 
 extern cell make_variable_declaration(cell name, cell value) {
-    return pair(get_symbol_len("variable_declaration"),
+    return pair(variable_declaration_tag,
                 pair(name,
                      pair(value, get_nil())));
 }
 
 extern cell make_function_declaration(cell name, cell names, cell block) {
-    return pair(get_symbol_len("function_declaration"),
+    return pair(function_declaration_tag,
                 pair(name, pair(names, pair(block, get_nil()))));
 }
 
@@ -190,7 +274,7 @@ static cell function_decl_to_constant_decl(cell component) {
                 function_declaration_body(component)));
 }
 
-static char *declaration_symbol(cell component) {
+static cell declaration_symbol(cell component) {
     return symbol_of_name(head(tail(component)));
 }
 
@@ -219,12 +303,12 @@ static cell scan_out_declarations(cell component) {
     return is_sequence(component)
            ? accumlate_statements(sequence_statements(component))
            : is_declaration(component)
-           ? pair(get_symbol_len(declaration_symbol(component)), get_nil())
+           ? pair(declaration_symbol(component), get_nil())
            : get_nil();
 }
 
 static int is_return_statement(cell component) {
-    return is_tagged_list(component, "return_statement");
+    return is_tagged_list(component, return_statement_tag);
 }
 
 static cell return_expression(cell component) {
@@ -232,7 +316,7 @@ static cell return_expression(cell component) {
 }
 
 static int is_name(cell component) {
-    return is_tagged_list(component, "name");
+    return is_tagged_list(component, name_tag);
 }
 
 extern cell make_conditional(char *tp, cell predicate, cell consequent, cell alternative) {
@@ -240,12 +324,12 @@ extern cell make_conditional(char *tp, cell predicate, cell consequent, cell alt
 }
 
 extern cell make_return_statement(cell expression) {
-    return pair(get_symbol_len("return_statement"), pair(expression, get_nil()));
+    return pair(return_statement_tag, pair(expression, get_nil()));
 }
 
 static int is_conditional(cell component) {
-    return is_tagged_list(component, "conditional_expression") ||
-           is_tagged_list(component, "conditional_statement");
+    return is_tagged_list(component, conditional_expression_tag) ||
+           is_tagged_list(component, conditional_statement_tag);
 }
 
 static cell conditional_predicate(cell component) {
@@ -261,14 +345,14 @@ static cell conditional_alternative(cell component) {
 }
 
 static int is_assignment(cell component) {
-    return is_tagged_list(component, "assignment");
+    return is_tagged_list(component, assignment_tag);
 }
 
 extern cell make_assignment(cell name, cell expression) {
-    return pair(get_symbol_len("assignment"), pair(name, pair(expression, get_nil())));
+    return pair(assignment_tag, pair(name, pair(expression, get_nil())));
 }
 
-static char *assignment_symbol(cell component) {
+static cell assignment_symbol(cell component) {
     return symbol_of_name(head(tail(component)));
 }
 
@@ -276,6 +360,63 @@ static cell assignment_value_expression(cell component) {
     return head(tail(tail(component)));
 }
 
+static int is_while_loop(cell component) {
+    return is_tagged_list(component, while_loop_tag);
+}
+
+extern cell make_while_loop(cell predicate, cell body) {
+    return pair(while_loop_tag, pair(predicate, pair(body, get_nil())));
+}
+
+static cell while_loop_predicate(cell component) {
+    return head(tail(component));
+}
+
+static cell while_loop_body(cell component) {
+    return head(tail(tail(component)));
+}
+
+static int is_for_loop(cell component) {
+    return is_tagged_list(component, for_loop_tag);
+}
+
+extern cell make_for_loop(cell initializer, cell predicate, cell update, cell body) {
+    return pair(for_loop_tag,
+                pair(initializer, pair(predicate, pair(update, pair(body, get_nil())))));
+}
+
+static cell for_loop_initializer(cell component) {
+    return head(tail(component));
+}
+
+static cell for_loop_predicate(cell component) {
+    return head(tail(tail(component)));
+}
+
+static cell for_loop_update(cell component) {
+    return head(tail(tail(tail(component))));
+}
+
+static cell for_loop_body(cell component) {
+    return head(tail(tail(tail(tail(component)))));
+}
+
+static int is_break_statement(cell component) {
+    return is_tagged_list(component, break_statement_tag);
+}
+
+extern cell make_break_statement() {
+    return pair(break_statement_tag, get_nil());
+}
+
+static int is_continue_statement(cell component) {
+    return is_tagged_list(component, continue_statement_tag);
+}
+
+extern cell make_continue_statement() {
+    return pair(continue_statement_tag, get_nil());
+}
+
 static cell first_statement(cell stmts) {
     return head(stmts);
 }
@@ -284,12 +425,16 @@ static cell rest_statements(cell stmts) {
     return tail(stmts);
 }
 
-static char *operator_symbol(cell component) {
-    return check_and_get_symbol(head(tail(component)));
+static cell operator_symbol(cell component) {
+    return head(tail(component));
+}
+
+static cell make_symbol_name(cell symbol) {
+    return pair(name_tag, pair(symbol, get_nil()));
 }
 
 extern cell make_name(char *operator) {
-    return pair(get_symbol_len("name"), pair(get_symbol_len(operator), get_nil()));
+    return make_symbol_name(get_symbol_len(operator));
 }
 
 static cell first_operand(cell component) {
@@ -301,26 +446,44 @@ static cell second_operand(cell component) {
 }
 
 static cell make_application1(cell op, cell first) {
-    return pair(get_symbol_len("application"),
+    return pair(application_tag,
                 pair(op, pair(pair(first, get_nil()), get_nil())));
 }
 
 static cell make_application2(cell op, cell first, cell second) {
-    return pair(get_symbol_len("application"),
+    return pair(application_tag,
                 pair(op, pair(pair(first, pair(second, get_nil())), get_nil())));
 }
 
 static cell operator_combination_to_application(cell component) {
-    char *operator = operator_symbol(component);
+    cell operator = operator_symbol(component);
 
     return is_unary_operator_combination(component)
-           ? make_application1(make_name(operator),
+           ? make_application1(make_symbol_name(operator),
                                first_operand(component))
-           : make_application2(make_name(operator),
+           : make_application2(make_symbol_name(operator),
                                first_operand(component),
                                second_operand(component));
 }
 
+static int operator_code(cell symbol) {
+    char *operator = get_symbol_view(&symbol).chars;
+
+    return strcmp(operator, "+") == 0 ? ADD_OPERATOR
+           : strcmp(operator, "-") == 0 ? SUBTRACT_OPERATOR
+           : strcmp(operator, "*") == 0 ? MULTIPLY_OPERATOR
+           : strcmp(operator, "%") == 0 ? REMAINDER_OPERATOR
+           : strcmp(operator, "===") == 0 ? EQUAL_OPERATOR
+           : strcmp(operator, "!==") == 0 ? NOT_EQUAL_OPERATOR
+           : strcmp(operator, "<") == 0 ? LESS_THAN_OPERATOR
+           : strcmp(operator, "<=") == 0 ? LESS_THAN_EQUAL_OPERATOR
+           : strcmp(operator, ">") == 0 ? MORE_THAN_OPERATOR
+           : strcmp(operator, ">=") == 0 ? MORE_THAN_EQUAL_OPERATOR
+           : strcmp(operator, "unary-") == 0 ? NEGATE_OPERATOR
+           : strcmp(operator, "!") == 0 ? NOT_OPERATOR
+           : -1;
+}
+
 static int is_empty_sequence(cell stmts) {
     return is_null(stmts);
 }
@@ -344,7 +507,7 @@ static cell lambda_parameters(cell component) {
 static cell lambda_parameter_symbols_inner(cell component) {
     return is_null(component)
            ? get_nil()
-           : pair(get_symbol_len(symbol_of_name(head(component))),
+           : pair(symbol_of_name(head(component)),
                   lambda_parameter_symbols_inner(tail(component)));
 }
 
@@ -356,30 +519,443 @@ static cell lambda_body(cell component) {
     return head(tail(tail(component)));
 }
 
-static cell empty_arglist() {
-    return get_nil();
+static int is_logical_composition(cell component) {
+    return is_tagged_list(component, logical_composition_tag);
+}
+
+static int is_logical_symbol(cell component, char *sym) {
+    return equal_symbol(head(tail(component)), sym);
+}
+
+static cell logical_first_operand(cell component) {
+    return head(tail(tail(component)));
+}
+
+static cell logical_second_operand(cell component) {
+    return head(tail(tail(tail(component))));
+}
+
+/*
+ * The analysis pass turns each component into a node: a vector whose
+ * kind selects the handler and whose elements are the pre-extracted
+ * children.  Operator combinations become operator nodes, or
+ * applications when the operator has no inline fast path, and function
+ * declarations become constant declarations here, and the names
+ * declared by a block are scanned out once.
+ *
+ * cenv lists the names of the frames the component will be evaluated
+ * in, innermost first, so that a name can be resolved to the depth of
+ * its frame and its index there.  Names not found are global and get
+ * depth -1 and a slot caching their binding once it has been looked up.
+ */
+static cell analyze(cell component, cell cenv);
+
+static cell make_node1(enum node_kind kind, cell child0) {
+    cell node = make_vector(kind, 1);
+
+    vector_set(node, 0, child0);
+    return node;
+}
+
+static cell make_node2(enum node_kind kind, cell child0, cell child1) {
+    cell node = make_vector(kind, 2);
+
+    vector_set(node, 0, child0);
+    vector_set(node, 1, child1);
+    return node;
+}
+
+static cell make_node3(enum node_kind kind, cell child0, cell child1, cell child2) {
+    cell node = make_vector(kind, 3);
+
+    vector_set(node, 0, child0);
+    vector_set(node, 1, child1);
+    vector_set(node, 2, child2);
+    return node;
+}
+
+static cell make_node4(enum node_kind kind, cell child0, cell child1, cell child2, cell child3) {
+    cell node = make_vector(kind, 4);
+
+    vector_set(node, 0, child0);
+    vector_set(node, 1, child1);
+    vector_set(node, 2, child2);
+    vector_set(node, 3, child3);
+    return node;
+}
+
+static cell make_node5(enum node_kind kind, cell child0, cell child1, cell child2, cell child3, cell child4) {
+    cell node = make_vector(kind, 5);
+
+    vector_set(node, 0, child0);
+    vector_set(node, 1, child1);
+    vector_set(node, 2, child2);
+    vector_set(node, 3, child3);
+    vector_set(node, 4, child4);
+    return node;
+}
+
+static int lexical_index(cell symbol, cell names, int index) {
+    return is_null(names)
+           ? -1
+           : eq_symbol(head(names), symbol)
+           ? index
+           : lexical_index(symbol, tail(names), index + 1);
+}
+
+static int lexical_depth(cell symbol, cell cenv, int depth) {
+    return is_null(cenv)
+           ? -1
+           : lexical_index(symbol, head(cenv), 0) >= 0
+           ? depth
+           : lexical_depth(symbol, tail(cenv), depth + 1);
+}
+
+static cell lexical_frame(cell cenv, int depth) {
+    return depth == 0 ? head(cenv) : lexical_frame(tail(cenv), depth - 1);
+}
+
+static cell lexical_address_index(cell symbol, cell cenv, int depth) {
+    return get_number(depth < 0 ? -1 : lexical_index(symbol, lexical_frame(cenv, depth), 0));
+}
+
+static cell analyze_name(cell symbol, cell cenv) {
+    int depth = lexical_depth(symbol, cenv, 0);
+
+    return make_node4(NAME_NODE, symbol, get_number(depth), lexical_address_index(symbol, cenv, depth),
+                      get_nil());
+}
+
+static cell analyze_definition(enum node_kind kind, cell symbol, cell value, cell cenv) {
+    int depth = lexical_depth(symbol, cenv, 0);
+
+    return make_node5(kind, symbol, get_number(depth), lexical_address_index(symbol, cenv, depth),
+                      analyze(value, cenv), get_nil());
+}
+
+/*
+ * An operator node holds the name node of the operator, its code and
+ * the analyzed operands, so that it can be computed without looking the
+ * operator up as a function or building an argument list.
+ */
+static cell analyze_operator_combination(cell component, cell cenv) {
+    cell symbol = operator_symbol(component);
+    int op = operator_code(symbol);
+
+    if(op < 0 || lexical_depth(symbol, cenv, 0) >= 0) {
+        return analyze(operator_combination_to_application(component), cenv);
+    } else if(is_unary_operator_combination(component)) {
+        return make_node3(OPERATOR_NODE, analyze_name(symbol, cenv), get_number(op),
+                          analyze(first_operand(component), cenv));
+    } else {
+        return make_node4(OPERATOR_NODE, analyze_name(symbol, cenv), get_number(op),
+                          analyze(first_operand(component), cenv),
+                          analyze(second_operand(component), cenv));
+    }
+}
+
+static cell analyze_list(cell components, cell cenv) {
+    return is_null(components)
+           ? get_nil()
+           : pair(analyze(head(components), cenv), analyze_list(tail(components), cenv));
+}
+
+/*
+ * A block declaring no names gets no frame of its own, so that the body
+ * of a loop or a function without declarations allocates nothing when
+ * it is entered.
+ */
+static cell analyze_block(cell names, cell body, cell cenv) {
+    return is_null(names)
+           ? analyze(body, cenv)
+           : make_node2(BLOCK_NODE, names, analyze(body, pair(names, cenv)));
+}
+
+/*
+ * The number of loops enclosing the component being analyzed within its
+ * function.  Break and continue need one, and a return unwinds them all.
+ */
+static int loop_depth = 0;
+
+static cell analyze_lambda(cell component, cell cenv) {
+    cell names = lambda_parameter_symbols(component);
+    int depth = loop_depth;
+    cell body;
+
+    loop_depth = 0;
+    body = analyze(lambda_body(component), pair(names, cenv));
+    loop_depth = depth;
+    return make_node2(LAMBDA_NODE, names, body);
+}
+
+/*
+ * A loop node holds the predicate, the body and the update of a for
+ * loop, or nil for a while loop.
+ */
+static cell analyze_loop(cell predicate, cell body, cell update, cell cenv) {
+    cell node = make_node3(LOOP_NODE, analyze(predicate, cenv), get_nil(),
+                           is_null(update) ? get_nil() : analyze(update, cenv));
+
+    loop_depth++;
+    vector_set(node, 1, analyze(body, cenv));
+    loop_depth--;
+    return node;
+}
+
+/*
+ * The name declared by the initializer of a for loop is in a frame around
+ * the whole loop, shared by all the iterations.
+ */
+static cell analyze_for_loop(cell component, cell cenv) {
+    cell initializer = for_loop_initializer(component);
+    cell names = scan_out_declarations(initializer);
+    cell inner = is_null(names) ? cenv : pair(names, cenv);
+    cell loop = analyze_loop(for_loop_predicate(component), for_loop_body(component),
+                             for_loop_update(component), inner);
+    cell body = make_node1(SEQUENCE_NODE, pair(analyze(initializer, inner), pair(loop, get_nil())));
+
+    return is_null(names) ? body : make_node2(BLOCK_NODE, names, body);
+}
+
+static cell analyze_loop_exit(enum node_kind kind) {
+    if(loop_depth == 0) {
+        PUT_ERROR(kind == BREAK_NODE ? "break outside a loop -- analyze" : "continue outside a loop -- analyze",
+                  get_nil());
+    }
+    return make_vector(kind, 0);
+}
+
+static cell analyze(cell component, cell cenv) {
+    if(is_literal(component)) {
+        return make_node1(LITERAL_NODE, literal_value(component));
+    } else if(is_name(component)) {
+        return analyze_name(symbol_of_name(component), cenv);
+    } else if(is_application(component)) {
+        return make_node2(APPLICATION_NODE,
+                          analyze(function_expression(component), cenv),
+                          analyze_list(arg_expressions(component), cenv));
+    } else if(is_operator_combination(component)) {
+        return analyze_operator_combination(component, cenv);
+    } else if(is_logical_composition(component)) {
+        return make_node2(is_logical_symbol(component, "&&") ? AND_NODE : OR_NODE,
+                          analyze(logical_first_operand(component), cenv),
+                          analyze(logical_second_operand(component), cenv));
+    } else if(is_conditional(component)) {
+        return make_node3(CONDITIONAL_NODE,
+                          analyze(conditional_predicate(component), cenv),
+                          analyze(conditional_consequent(component), cenv),
+                          analyze(conditional_alternative(component), cenv));
+    } else if(is_lambda_expression(component)) {
+        return analyze_lambda(component, cenv);
+    } else if(is_sequence(component)) {
+        return make_node1(SEQUENCE_NODE, analyze_list(sequence_statements(component), cenv));
+    } else if(is_block(component)) {
+        return analyze_block(scan_out_declarations(block_body(component)), block_body(component), cenv);
+    } else if(is_return_statement(component)) {
+        return make_node2(RETURN_NODE, analyze(return_expression(component), cenv), get_number(loop_depth));
+    } else if(is_while_loop(component)) {
+        return analyze_loop(while_loop_predicate(component), while_loop_body(component), get_nil(), cenv);
+    } else if(is_for_loop(component)) {
+        return analyze_for_loop(component, cenv);
+    } else if(is_break_statement(component)) {
+        return analyze_loop_exit(BREAK_NODE);
+    } else if(is_continue_statement(component)) {
+        return analyze_loop_exit(CONTINUE_NODE);
+    } else if(is_function_declaration(component)) {
+        return analyze(function_decl_to_constant_decl(component), cenv);
+    } else if(is_declaration(component)) {
+        return analyze_definition(DECLARATION_NODE, declaration_symbol(component),
+                                  declaration_value_expression(component), cenv);
+    } else if(is_assignment(component)) {
+        return analyze_definition(ASSIGNMENT_NODE, assignment_symbol(component),
+                                  assignment_value_expression(component), cenv);
+    } else {
+        PUT_ERROR("unknown type -- analyze", head(component));
+    }
+}
+
+static cell literal_node_value(cell node) {
+    return vector_ref(node, 0);
+}
+
+static cell address_node_symbol(cell node) {
+    return vector_ref(node, 0);
+}
+
+static int address_node_depth(cell node) {
+    return check_and_get_int(vector_ref(node, 1));
+}
+
+static int address_node_index(cell node) {
+    return check_and_get_int(vector_ref(node, 2));
+}
+
+static cell global_node_binding(cell node, int cache) {
+    cell binding = vector_ref(node, cache);
+
+    if(is_null(binding)) {
+        binding = lookup_global_binding(address_node_symbol(node), env);
+        vector_set(node, cache, binding);
+    }
+    return binding;
+}
+
+static cell application_node_function(cell node) {
+    return vector_ref(node, 0);
+}
+
+static cell application_node_arguments(cell node) {
+    return vector_ref(node, 1);
+}
+
+static cell logical_node_first(cell node) {
+    return vector_ref(node, 0);
+}
+
+static cell logical_node_second(cell node) {
+    return vector_ref(node, 1);
+}
+
+static cell conditional_node_predicate(cell node) {
+    return vector_ref(node, 0);
+}
+
+static cell conditional_node_consequent(cell node) {
+    return vector_ref(node, 1);
+}
+
+static cell conditional_node_alternative(cell node) {
+    return vector_ref(node, 2);
+}
+
+static cell lambda_node_parameters(cell node) {
+    return vector_ref(node, 0);
+}
+
+static cell lambda_node_body(cell node) {
+    return vector_ref(node, 1);
+}
+
+static cell sequence_node_statements(cell node) {
+    return vector_ref(node, 0);
+}
+
+static cell block_node_names(cell node) {
+    return vector_ref(node, 0);
+}
+
+static cell block_node_body(cell node) {
+    return vector_ref(node, 1);
+}
+
+static cell return_node_expression(cell node) {
+    return vector_ref(node, 0);
+}
+
+static int return_node_loops(cell node) {
+    return check_and_get_int(vector_ref(node, 1));
+}
+
+static cell loop_node_predicate(cell node) {
+    return vector_ref(node, 0);
+}
+
+static cell loop_node_body(cell node) {
+    return vector_ref(node, 1);
+}
+
+static cell loop_node_update(cell node) {
+    return vector_ref(node, 2);
+}
+
+static cell definition_node_value(cell node) {
+    return vector_ref(node, 3);
+}
+
+static cell operator_node_name(cell node) {
+    return vector_ref(node, 0);
+}
+
+static enum operator_code operator_node_code(cell node) {
+    return check_and_get_int(vector_ref(node, 1));
+}
+
+static cell operator_node_first(cell node) {
+    return vector_ref(node, 2);
+}
+
+static cell operator_node_second(cell node) {
+    return vector_ref(node, 3);
+}
+
+static int is_unary_operator_node(cell node) {
+    return vector_length(node) == 3;
+}
+
+static cell name_node_value(cell node) {
+    int depth = address_node_depth(node);
+
+    return depth < 0
+           ? tail(global_node_binding(node, 3))
+           : lookup_lexical_value(depth, address_node_index(node), env);
+}
+
+static int is_number(cell c) {
+    return CELL_TYPE(c) == NUMBER;
+}
+
+/*
+ * The inline results must be the ones the primitives in runtime.c give.
+ */
+static double compute_number_operator(enum operator_code op, double left, double right) {
+    return op == ADD_OPERATOR ? left + right
+           : op == SUBTRACT_OPERATOR ? left - right
+           : op == MULTIPLY_OPERATOR ? left * right
+           : op == REMAINDER_OPERATOR ? fmod(left, right)
+           : op == LESS_THAN_OPERATOR ? left < right
+           : op == LESS_THAN_EQUAL_OPERATOR ? !(left > right)
+           : op == MORE_THAN_OPERATOR ? left > right
+           : op == MORE_THAN_EQUAL_OPERATOR ? !(left < right)
+           : -left;
+}
+
+static int can_compute_inline(enum operator_code op, cell left, cell right) {
+    return op == EQUAL_OPERATOR || op == NOT_EQUAL_OPERATOR || op == NOT_OPERATOR ||
+           (is_number(left) && is_number(right));
+}
+
+static cell compute_operator(enum operator_code op, cell left, cell right) {
+    return op == EQUAL_OPERATOR ? get_number(eqv(left, right))
+           : op == NOT_EQUAL_OPERATOR ? get_number(!eqv(left, right))
+           : op == NOT_OPERATOR ? (is_falsy(left) ? get_true() : get_false())
+           : get_number(compute_number_operator(op, CELL_NUMBER(left), CELL_NUMBER(right)));
 }
 
 static int is_last_argument_expression(cell arg_expression) {
     return is_null(tail(arg_expression));
 }
 
-static cell adjoin_arg(cell arg, cell arglist) {
-    return append(arglist, pair(arg, get_nil()));
+/*
+ * The function and then the evaluated arguments are pushed on the stack
+ * and argc counts the arguments, so an application builds no argument
+ * list.  While an argument is evaluated argc is saved above the ones
+ * already pushed.
+ */
+static cell *arguments() {
+    return stack_arguments(argc);
 }
 
 static void eval_dispatch();
-static void apply_dispatch();
 
 static void ev_conditional_decide() {
     continuation = restore_continuation();
     env = restore_cons();
     comp = restore();
     if(is_falsy(val)) {
-        comp = conditional_alternative(comp);
+        comp = conditional_node_alternative(comp);
         next = eval_dispatch;
     } else {
-        comp = conditional_consequent(comp);
+        comp = conditional_node_consequent(comp);
         next = eval_dispatch;
     }
 }
@@ -417,16 +993,19 @@ static void ev_sequence_empty() {
 static void ev_appl_argument_expression_loop();
 
 static void ev_appl_accumulate_arg() {
+    argc = check_and_get_int(restore());
     unev = restore();
     env = restore_cons();
-    argl = adjoin_arg(val, restore());
+    save(val);
+    argc++;
     unev = tail(unev);
     next = ev_appl_argument_expression_loop;
 }
 
 static void ev_appl_accum_last_arg() {
-    argl = adjoin_arg(val, restore());
-    fun = restore();
+    argc = check_and_get_int(restore());
+    save(val);
+    argc++;
     next = apply_dispatch;
 }
 
@@ -436,13 +1015,14 @@ static void ev_appl_last_arg() {
 }
 
 static void ev_appl_argument_expression_loop() {
-    save(argl);
     comp = head(unev);
     if(is_last_argument_expression(unev)) {
+        save(get_number(argc));
         next = ev_appl_last_arg;
     } else {
         save_cons(env);
         save(unev);
+        save(get_number(argc));
         continuation = ev_appl_accumulate_arg;
         next = eval_dispatch;
     }
@@ -451,12 +1031,12 @@ static void ev_appl_argument_expression_loop() {
 static void ev_appl_did_function_expression() {
     unev = restore();
     env = restore_cons();
-    argl = empty_arglist();
     fun = val;
+    save(fun);
+    argc = 0;
     if(is_null(unev)) {
         next = apply_dispatch;
     } else {
-        save(fun);
         next = ev_appl_argument_expression_loop;
     }
 }
@@ -464,20 +1044,16 @@ static void ev_appl_did_function_expression() {
 static void ev_application() {
     save_continuation(continuation);
     save_cons(env);
-    unev = arg_expressions(comp);
+    unev = application_node_arguments(comp);
     save(unev);
-    comp = function_expression(comp);
+    comp = application_node_function(comp);
     continuation = ev_appl_did_function_expression;
     next = eval_dispatch;
 }
 
-static void ev_operator_combination() {
-    comp = operator_combination_to_application(comp);
-    next = ev_application;
-}
-
 static void primitive_apply() {
-    val = apply_primitive_function(fun, argl);
+    val = apply_primitive_function(fun, argc, arguments());
+    drop_stack(argc + 1);
     continuation = restore_continuation();
     next = continuation;
 }
@@ -489,17 +1065,53 @@ static void return_undefined() {
     next = continuation;
 }
 
+/*
+ * The continuation of a return expression.  An application evaluated
+ * with it is a tail call: the callee takes over the marker of the
+ * current frame and the continuation saved under it.
+ */
+extern void return_value() {
+    revert_stack_to_marker();
+    continuation = restore_continuation();
+    next = continuation;
+}
+
+static int is_tail_call() {
+    cell saved = stack_arguments(argc + 2)[0];
+
+    return CELL_TYPE(saved) == CONTINUATION && CELL_CONTINUATION(saved) == return_value;
+}
+
+/*
+ * Drops the arguments, the function and the continuation of the
+ * application, or pushes the marker of the new frame above them.
+ */
+static void enter_frame() {
+    if(is_tail_call()) {
+        drop_stack(argc + 2);
+    } else {
+        drop_stack(argc + 1);
+        push_marker_to_stack();
+    }
+}
+
 static void compound_apply() {
     unev = function_parameters(fun);
-    env = extend_environment(unev, argl, function_environment(fun));
+    env = extend_environment_arguments(unev, argc, arguments(), function_environment(fun));
+    enter_frame();
     comp = function_body(fun);
-    push_marker_to_stack();
     continuation = return_undefined;
     next = eval_dispatch;
 }
 
+static void compiled_apply() {
+    env = extend_environment_arguments(function_parameters(fun), argc, arguments(), function_environment(fun));
+    enter_frame();
+    next = compiled_function_entry(fun);
+}
+
 static void continuation_apply() {
-    cell valtmp = head(argl);
+    cell valtmp = argc > 0 ? arguments()[0] : get_undefined();
     cons *regs = check_and_get_cons_ptr(continuation_registers(fun));
 
     restore_registers(regs);
@@ -509,44 +1121,170 @@ static void continuation_apply() {
     next = continuation;
 }
 
-static void apply_dispatch() {
+/*
+ * An escape continuation reverts the stack to the frame of its call_ec
+ * in one step.  Once that frame has returned nothing is left to go back
+ * to, which is what call_cc is for.
+ */
+extern void revert_stack_to_escape(cell escape) {
+    long frame = check_and_get_int(head(tail(escape)));
+    long serial = (long)check_and_get_number(head(tail(tail(escape))));
+
+    if(!revert_stack_to_frame(frame, serial)) {
+        PUT_ERROR("Escape from a call_ec which has returned -- revert_stack_to_escape", escape);
+    }
+}
+
+static void escape_apply() {
+    cell valtmp = argc > 0 ? arguments()[0] : get_undefined();
+
+    revert_stack_to_escape(fun);
+    continuation = restore_continuation();
+    val = valtmp;
+    next = continuation;
+}
+
+extern void apply_dispatch() {
+    fun = stack_arguments(argc + 1)[0];
     if(is_primitive_function(fun)) {
         next = primitive_apply;
     } else if(is_compound_function(fun)) {
         next = compound_apply;
+    } else if(is_compiled_function(fun)) {
+        next = compiled_apply;
     } else if(is_continuation(fun)) {
         next = continuation_apply;
+    } else if(is_escape(fun)) {
+        next = escape_apply;
     } else {
         PUT_ERROR("Internal error -- apply_dispatch", get_nil());
     }
 }
 
-static void ev_return() {
+/*
+ * A loop keeps the continuation and the environment it was entered with
+ * and its node under a marker of its own and iterates above it, so that
+ * break and continue unwind to it in one step and a return unwinds the
+ * loops it is in before it unwinds its function.
+ */
+extern void enter_loop(cell loop) {
+    save_continuation(continuation);
+    save_cons(env);
+    save(loop);
+    push_marker_to_stack();
+}
+
+static cell *loop_frame() {
+    return stack_arguments(4);
+}
+
+extern cons *loop_environment() {
+    return check_and_get_cons_ptr(loop_frame()[1]);
+}
+
+extern void exit_loop() {
     revert_stack_to_marker();
+    drop_stack(1);
+    env = restore_cons();
     continuation = restore_continuation();
-    comp = return_expression(comp);
+    val = get_undefined();
+}
+
+extern void unwind_loops(int count) {
+    for(; count > 0; count--) {
+        revert_stack_to_marker();
+        drop_stack(3);
+    }
+}
+
+static void ev_loop_decide();
+
+static void ev_loop_test() {
+    env = loop_environment();
+    comp = loop_node_predicate(loop_frame()[2]);
+    continuation = ev_loop_decide;
     next = eval_dispatch;
 }
 
+static void ev_loop_update() {
+    env = loop_environment();
+    comp = loop_node_update(loop_frame()[2]);
+    if(is_null(comp)) {
+        next = ev_loop_test;
+    } else {
+        continuation = ev_loop_test;
+        next = eval_dispatch;
+    }
+}
+
+static void ev_loop_decide() {
+    if(is_falsy(val)) {
+        exit_loop();
+        next = continuation;
+    } else {
+        env = loop_environment();
+        comp = loop_node_body(loop_frame()[2]);
+        continuation = ev_loop_update;
+        next = eval_dispatch;
+    }
+}
+
+static void ev_loop() {
+    enter_loop(comp);
+    next = ev_loop_test;
+}
+
+static void ev_break() {
+    exit_loop();
+    next = continuation;
+}
+
+static void ev_continue() {
+    drop_stack_to_marker();
+    next = ev_loop_update;
+}
+
+static void ev_return() {
+    unwind_loops(return_node_loops(comp));
+    drop_stack_to_marker();
+    continuation = return_value;
+    comp = return_node_expression(comp);
+    next = eval_dispatch;
+}
+
+extern cons *extend_block_environment(cell names, cons *env) {
+    return extend_environment(names, list_of_unassigned(names), env);
+}
+
 static void ev_block() {
-    comp = block_body(comp);
-    val = scan_out_declarations(comp);
-    env = extend_environment(val, list_of_unassigned(val), env);
+    val = block_node_names(comp);
+    comp = block_node_body(comp);
+    env = extend_block_environment(val, env);
     next = eval_dispatch;
 }
 
+static void assign_definition(cell node) {
+    int depth = address_node_depth(node);
+
+    if(depth < 0) {
+        set_tail(global_node_binding(node, 4), val);
+    } else {
+        assign_lexical_value(depth, address_node_index(node), val, env);
+    }
+}
+
 static void ev_assignment_install() {
     continuation = restore_continuation();
     env = restore_cons();
     unev = restore();
-    assign_symbol_value(check_and_get_symbol(unev), val, env);
+    assign_definition(unev);
     next = continuation;
 }
 
 static void ev_assignment() {
-    unev = get_symbol_len(assignment_symbol(comp));
+    unev = comp;
     save(unev);
-    comp = assignment_value_expression(comp);
+    comp = definition_node_value(comp);
     save_cons(env);
     save_continuation(continuation);
     continuation = ev_assignment_install;
@@ -557,49 +1295,28 @@ static void ev_declaration_assign() {
     continuation = restore_continuation();
     env = restore_cons();
     unev = restore();
-    assign_symbol_value(check_and_get_symbol(unev), val, env);
+    assign_definition(unev);
     val = get_undefined();
     next = continuation;
 }
 
 static void ev_declaration() {
-    unev = get_symbol_len(declaration_symbol(comp));
+    unev = comp;
     save(unev);
-    comp = declaration_value_expression(comp);
+    comp = definition_node_value(comp);
     save_cons(env);
     save_continuation(continuation);
     continuation = ev_declaration_assign;
     next = eval_dispatch;
 }
 
-static void ev_function_declaration() {
-    comp = function_decl_to_constant_decl(comp);
-    next = ev_declaration;
-}
-
-static int is_logical_composition(cell component) {
-    return is_tagged_list(component, "logical_composition");
-}
-
-static int is_logical_symbol(cell component, char *sym) {
-    return equal_symbol(head(tail(component)), sym);
-}
-
-static cell logical_first_operand(cell component) {
-    return head(tail(tail(component)));
-}
-
-static cell logical_second_operand(cell component) {
-    return head(tail(tail(tail(component))));
-}
-
 static void and_first() {
     continuation = restore_continuation();
     comp = restore();
     if(is_falsy(val)) {
         next = continuation;
     } else {
-        comp = logical_second_operand(comp);
+        comp = logical_node_second(comp);
         next = eval_dispatch;
     }
 }
@@ -607,7 +1324,7 @@ static void and_first() {
 static void ev_and_composition() {
     save(comp);
     save_continuation(continuation);
-    comp = logical_first_operand(comp);
+    comp = logical_node_first(comp);
     continuation = and_first;
     next = eval_dispatch;
 }
@@ -616,7 +1333,7 @@ static void or_first() {
     continuation = restore_continuation();
     comp = restore();
     if(is_falsy(val)) {
-        comp = logical_second_operand(comp);
+        comp = logical_node_second(comp);
         next = eval_dispatch;
     } else {
         next = continuation;
@@ -626,67 +1343,159 @@ static void or_first() {
 static void ev_or_composition() {
     save(comp);
     save_continuation(continuation);
-    comp = logical_first_operand(comp);
+    comp = logical_node_first(comp);
     continuation = or_first;
     next = eval_dispatch;
 }
 
-static void eval_dispatch() {
-    if(is_literal(comp)) {
-        val = literal_value(comp);
-        next = continuation;
-    } else if(is_name(comp)) {
-        val = lookup_variable_value(symbol_of_name(comp), env);
-        next = continuation;
-    } else if(is_application(comp)) {
-        next = ev_application;
-    } else if(is_operator_combination(comp)) {
-        next = ev_operator_combination;
-    } else if(is_logical_composition(comp)) {
-        next = is_logical_symbol(comp, "&&") ? ev_and_composition : ev_or_composition;
-    } else if(is_conditional(comp)) {
-        save(comp);
-        save_cons(env);
-        save_continuation(continuation);
-        continuation = ev_conditional_decide;
-        comp = conditional_predicate(comp);
-        next = eval_dispatch;
-    } else if(is_lambda_expression(comp)) {
-        unev = lambda_parameter_symbols(comp);
-        comp = lambda_body(comp);
-        val = make_function(unev, comp, env);
+/*
+ * Computes an operator inline when its name is still bound to the
+ * primitive and the operands suit it; otherwise applies whatever the
+ * name is bound to, as an application would.
+ */
+static void ev_operator_apply(cell left, cell right) {
+    enum operator_code op = operator_node_code(comp);
+
+    if(is_operator_primitive(fun, op) && can_compute_inline(op, left, right)) {
+        val = compute_operator(op, left, right);
+        continuation = restore_continuation();
         next = continuation;
-    } else if(is_sequence(comp)) {
-        unev = sequence_statements(comp);
-        if(is_empty_sequence(unev)) {
-            next = ev_sequence_empty;
+    } else {
+        save(fun);
+        save(left);
+        if(is_unary_operator_node(comp)) {
+            argc = 1;
         } else {
-            save_continuation(continuation);
-            next = ev_sequence_next;
+            save(right);
+            argc = 2;
         }
-    } else if(is_block(comp)) {
-        next = ev_block;
-    } else if(is_return_statement(comp)) {
-        next = ev_return;
-    } else if(is_function_declaration(comp)) {
-        next = ev_function_declaration;
-    } else if(is_declaration(comp)) {
-        next = ev_declaration;
-    } else if(is_assignment(comp)) {
-        next = ev_assignment;
+        next = apply_dispatch;
+    }
+}
+
+static void ev_operator_did_second() {
+    comp = restore();
+    unev = restore();
+    fun = restore();
+    ev_operator_apply(unev, val);
+}
+
+static void ev_operator_did_first() {
+    env = restore_cons();
+    comp = restore();
+    if(is_unary_operator_node(comp)) {
+        fun = restore();
+        ev_operator_apply(val, val);
     } else {
-        PUT_ERROR("unknown type -- eval_dispatch", head(comp));
+        save(val);
+        save(comp);
+        comp = operator_node_second(comp);
+        continuation = ev_operator_did_second;
+        next = eval_dispatch;
     }
 }
 
-static void execute_machine(cell program, cons *environment) {
-    cell tmpcomp;
+static int is_immediate_node(cell node) {
+    return vector_kind(node) == LITERAL_NODE || vector_kind(node) == NAME_NODE;
+}
 
-    comp = program;
-    val = scan_out_declarations(comp);
-    tmpcomp = list_of_unassigned(val);
-    env = extend_environment(val, tmpcomp, environment);
+static cell immediate_node_value(cell node) {
+    return vector_kind(node) == LITERAL_NODE ? literal_node_value(node) : name_node_value(node);
+}
+
+/*
+ * Operands which are literals or names are fetched right away rather
+ * than evaluated in steps of their own, as in the tests and the updates
+ * of most loops.
+ */
+static void ev_operator() {
+    save_continuation(continuation);
+    fun = name_node_value(operator_node_name(comp));
+    if(is_unary_operator_node(comp) && is_immediate_node(operator_node_first(comp))) {
+        val = immediate_node_value(operator_node_first(comp));
+        ev_operator_apply(val, val);
+    } else if(!is_unary_operator_node(comp) && is_immediate_node(operator_node_first(comp)) &&
+              is_immediate_node(operator_node_second(comp))) {
+        unev = immediate_node_value(operator_node_first(comp));
+        val = immediate_node_value(operator_node_second(comp));
+        ev_operator_apply(unev, val);
+    } else {
+        save(fun);
+        save(comp);
+        save_cons(env);
+        comp = operator_node_first(comp);
+        continuation = ev_operator_did_first;
+        next = eval_dispatch;
+    }
+}
+
+static void ev_literal() {
+    val = literal_node_value(comp);
+    next = continuation;
+}
+
+static void ev_name() {
+    val = name_node_value(comp);
+    next = continuation;
+}
+
+static void ev_conditional() {
+    save(comp);
+    save_cons(env);
+    save_continuation(continuation);
+    continuation = ev_conditional_decide;
+    comp = conditional_node_predicate(comp);
     next = eval_dispatch;
+}
+
+static void ev_lambda() {
+    unev = lambda_node_parameters(comp);
+    comp = lambda_node_body(comp);
+    val = make_function(unev, comp, env);
+    next = continuation;
+}
+
+static void ev_sequence() {
+    unev = sequence_node_statements(comp);
+    if(is_empty_sequence(unev)) {
+        next = ev_sequence_empty;
+    } else {
+        save_continuation(continuation);
+        next = ev_sequence_next;
+    }
+}
+
+static cont_type eval_handlers[NODE_KINDS] = {
+    ev_literal,
+    ev_name,
+    ev_application,
+    ev_and_composition,
+    ev_or_composition,
+    ev_conditional,
+    ev_lambda,
+    ev_sequence,
+    ev_block,
+    ev_return,
+    ev_declaration,
+    ev_assignment,
+    ev_operator,
+    ev_loop,
+    ev_break,
+    ev_continue
+};
+
+static void eval_dispatch() {
+    eval_handlers[vector_kind(comp)]();
+}
+
+extern void define_unassigned(cell symbols, cons *environment) {
+    for(; is_pair(symbols); symbols = tail(symbols)) {
+        define_global_value(head(symbols), unassigned_value, environment);
+    }
+}
+
+static void run_machine(cont_type entry) {
+    next = entry;
     continuation = NULL;
     save_continuation(continuation);
     while(next != NULL) {
@@ -695,9 +1504,42 @@ static void execute_machine(cell program, cons *environment) {
     }
 }
 
-extern cons *create_environment(cell program, cons *environment) {
+/*
+ * The top-level declarations of a program are global, so they are
+ * defined in the given global environment before it runs.
+ */
+static void execute_machine(cell program, cons *environment) {
+    define_unassigned(scan_out_declarations(program), environment);
+    comp = analyze(program, get_nil());
+    env = environment;
+    run_machine(eval_dispatch);
+}
+
+extern cell program_declarations(cell program) {
+    return scan_out_declarations(program);
+}
+
+extern cell analyze_program(cell program) {
+    loop_depth = 0;
+    return analyze(program, get_nil());
+}
+
+/*
+ * Runs a compiled program from its entry in the global environment, after
+ * defining the names it declares as execute_machine does.
+ */
+extern cell execute_compiled(cont_type entry, cell names) {
+    define_unassigned(names, env);
+    run_machine(entry);
+    return val;
+}
+
+/*
+ * The environment is left in env, which the collector relocates while
+ * the program runs.
+ */
+extern void create_environment(cell program, cons *environment) {
     execute_machine(program, environment);
-    return env;
 }
 
 extern cell evaluate(cell program, cons *environment) {
@@ -715,6 +1557,20 @@ extern cell execute(char *program) {
     }
 }
 
+/*
+ * Makes the machine ready for another program after one has been stopped
+ * by an error, keeping the global environment.
+ */
+extern void reset_machine() {
+    reset_stack();
+    env = global_environment(env);
+    comp = get_nil();
+    val = get_nil();
+    continuation = NULL;
+    fun = get_nil();
+    unev = get_nil();
+}
+
 static cell push_comp() {
     return comp;
 }
@@ -735,10 +1591,6 @@ static cell push_fun() {
     return fun;
 }
 
-static cell push_argl() {
-    return argl;
-}
-
 static cell push_unev() {
     return unev;
 }
@@ -763,33 +1615,58 @@ static void relocate_fun(cell c) {
     fun = c;
 }
 
-static void relocate_argl(cell c) {
-    argl = c;
-}
-
 static void relocate_unev(cell c) {
     unev = c;
 }
 
-#define CALL_CC \
-    "['sequence',[[['constant_declaration',[['name',['call_cc',null]]," \
+/*
+ * const name = k => { const a = getter(); return k(a); }
+ *
+ * call_cc copies the registers and the stack with %getcont, while
+ * call_ec only names the frame of the call with %getesc.
+ */
+#define CONTINUATION_DECLARATION(name, getter) \
+    "['constant_declaration',[['name',['" name "',null]]," \
     "[['lambda_expression',[[['name',['k',null]],null],[['block',[['sequence'," \
     "[[['constant_declaration',[['name',['a',null]],[['application',[['name'," \
-    "['%getcont',null]],[null,null]]],null]]],[['return_statement'," \
+    "['" getter "',null]],[null,null]]],null]]],[['return_statement'," \
     "[['application',[['name',['k',null]],[[['name',['a',null]],null],null]]]" \
-    ",null]],null]],null]],null]],null]]],null]]],null],null]]"
+    ",null]],null]],null]],null]],null]]],null]]]"
 
-extern void init_cons() {
-    cons *env_local = setup_environment();
+#define CALL_CC \
+    "['sequence',[[" CONTINUATION_DECLARATION("call_cc", "%getcont") \
+    ",[" CONTINUATION_DECLARATION("call_ec", "%getesc") ",null]],null]]"
 
-    cell cc = parse(CALL_CC);
-    env = create_environment(cc, env_local);
+extern cell call_cc_program() {
+    return parse(CALL_CC);
+}
 
+/*
+ * What a machine needs before its global environment is either built by
+ * init_cons or loaded from a snapshot.
+ */
+static void init_machine() {
+    init_tags();
     add_register(push_comp, relocate_comp);
     add_register(push_env, relocate_env);
     add_register(push_val, relocate_val);
     add_register(push_fun, relocate_fun);
-    add_register(push_argl, relocate_argl);
     add_register(push_unev, relocate_unev);
 }
 
+extern void init_cons() {
+    cons *env_local;
+
+    init_machine();
+    env_local = setup_environment();
+
+    cell cc = call_cc_program();
+    create_environment(cc, env_local);
+}
+
+extern void init_cons_from_snapshot(char *path) {
+    init_machine();
+    init_primitives();
+    load_snapshot(path);
+}
+
@@ -8,18 +8,206 @@
  **/
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include "memory.h"
 
-int main(int argc, char **argv) {
-    if(argc < 2) {
-        fprintf(stderr, "usage: %s <program>\n", argv[0]);
+static void usage(char *name) {
+    fprintf(stderr, "usage: %s [--gc=copying|generational|incremental|parallel|compact] [--gc-threads=N] [--compile|--vm|--cache=DIR] [--snapshot-in=FILE] [--snapshot-out=FILE] [--server[=SOCKET]] <program>\n", name);
+    exit(1);
+}
+
+static int compile_only = FALSE;
+static int use_vm = FALSE;
+static char *snapshot_in = NULL;
+static char *snapshot_out = NULL;
+static int server = FALSE;
+static char *server_socket = NULL;
+
+static int parse_option(char *option) {
+    if(strcmp(option, "--compile") == 0) {
+        compile_only = TRUE;
+        return TRUE;
+    } else if(strcmp(option, "--vm") == 0) {
+        use_vm = TRUE;
+        return TRUE;
+    } else if(strncmp(option, "--cache=", 8) == 0) {
+        set_vm_cache(option + 8);
+        use_vm = TRUE;
+        return TRUE;
+    } else if(strncmp(option, "--snapshot-in=", 14) == 0) {
+        snapshot_in = option + 14;
+        return TRUE;
+    } else if(strncmp(option, "--snapshot-out=", 15) == 0) {
+        snapshot_out = option + 15;
+        return TRUE;
+    } else if(strcmp(option, "--server") == 0) {
+        server = TRUE;
+        return TRUE;
+    } else if(strncmp(option, "--server=", 9) == 0) {
+        server = TRUE;
+        server_socket = option + 9;
+        return TRUE;
     } else {
-        init_memory();
-        init_cons();
+        return set_gc_option(option);
+    }
+}
 
-        cell r = execute(argv[1]);
-        display(r);
+static cell execute_program(char *program) {
+    return use_vm ? execute_vm(program) : execute(program);
+}
+
+/*
+ * A server reads programs from its standard input or from the
+ * connections to a Unix domain socket and runs them one after another in
+ * the same global environment.  A request is the lines up to one holding
+ * only a period or up to the end of the input, and the answer is what the
+ * program displays followed by its value or its error, ended by a line
+ * holding only a period.
+ */
+static jmp_buf request_loop;
+
+static void return_to_request_loop() __attribute__((noreturn));
+
+static void return_to_request_loop() {
+    longjmp(request_loop, 1);
+}
+
+static char *read_request(FILE *in) {
+    char *request = NULL;
+    size_t length = 0;
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t read;
+
+    while((read = getline(&line, &size, in)) > 0 && strcmp(line, ".\n") != 0) {
+        request = realloc(request, length + read + 1);
+        if(request == NULL) {
+            PUT_ERROR("Out of memory -- read_request", get_nil());
+        }
+        memcpy(request + length, line, read + 1);
+        length += read;
     }
+    if(read > 0 && request == NULL && (request = calloc(1, 1)) == NULL) {
+        PUT_ERROR("Out of memory -- read_request", get_nil());
+    }
+    free(line);
+    return request;
 }
 
+/*
+ * The error handler is set only while request_loop holds this call, so
+ * an error in reading the requests ends the process.
+ */
+static void serve_request(char *request) {
+    if(setjmp(request_loop) == 0) {
+        set_error_handler(return_to_request_loop);
+        display(execute_program(request));
+    }
+    set_error_handler(NULL);
+    reset_machine();
+    printf(".\n");
+    fflush(stdout);
+}
 
+static void serve(FILE *in) {
+    char *request;
+
+    while((request = read_request(in)) != NULL) {
+        serve_request(request);
+        free(request);
+    }
+}
+
+/*
+ * The output of the server goes to each connection while it is served.
+ */
+static void serve_socket(char *path) {
+    struct sockaddr_un address;
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    int out = dup(STDOUT_FILENO);
+    int err = dup(STDERR_FILENO);
+    int connection;
+    FILE *in;
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+    unlink(path);
+    if(listener < 0 || bind(listener, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(listener, 8) < 0) {
+        perror(path);
+        exit(1);
+    }
+    signal(SIGPIPE, SIG_IGN);
+    for(;;) {
+        if((connection = accept(listener, NULL, NULL)) >= 0) {
+            fflush(stdout);
+            dup2(connection, STDOUT_FILENO);
+            dup2(connection, STDERR_FILENO);
+            in = fdopen(connection, "r");
+            serve(in);
+            fflush(stdout);
+            dup2(out, STDOUT_FILENO);
+            dup2(err, STDERR_FILENO);
+            fclose(in);
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    int i;
+
+    for(i = 1; i < argc && strncmp(argv[i], "--", 2) == 0; i++) {
+        if(!parse_option(argv[i])) {
+            usage(argv[0]);
+        }
+    }
+    /*
+     * A snapshot holds the environment of the evaluator, whose functions
+     * the VM cannot call.  With --snapshot-out the program is a prelude
+     * run before saving, and may be left out, as it may be with --server.
+     */
+    if((i >= argc && snapshot_out == NULL && !server)
+       || (use_vm && (snapshot_in != NULL || snapshot_out != NULL))
+       || (server && (compile_only || snapshot_out != NULL))) {
+        usage(argv[0]);
+    } else {
+        init_memory();
+        if(snapshot_in != NULL) {
+            init_cons_from_snapshot(snapshot_in);
+        } else {
+            init_cons();
+        }
+
+        if(server) {
+            if(use_vm) {
+                init_vm();
+            }
+            if(i < argc) {
+                execute_program(argv[i]);
+            }
+            if(server_socket != NULL) {
+                serve_socket(server_socket);
+            } else {
+                serve(stdin);
+            }
+        } else if(snapshot_out != NULL) {
+            if(i < argc) {
+                execute(argv[i]);
+            }
+            save_snapshot(snapshot_out);
+        } else if(compile_only) {
+            compile_program(argv[i], stdout);
+        } else if(use_vm) {
+            init_vm();
+            display(execute_vm(argv[i]));
+        } else {
+            cell r = execute(argv[i]);
+            display(r);
+        }
+    }
+}
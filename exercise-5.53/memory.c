@@ -9,22 +9,77 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
 #include <ctype.h>
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "memory.h"
 
-#define MEMORY_COLLECT_SIZE 300000
-#define MEMORY_SIZE (MEMORY_COLLECT_SIZE + 2000)
-#define SYMBOL_MEMORY_SIZE 700000
+#define INITIAL_MEMORY_SIZE 65536
+#define MAX_MEMORY_SIZE (1L << 27)
+#define INITIAL_SYMBOL_MEMORY_SIZE (1L << 20)
+#define MAX_SYMBOL_MEMORY_SIZE (1L << 32)
+#define HEAP_GROWTH_FACTOR 3
+#define HUGE_PAGE_SIZE (2L << 20)
+#define NURSERY_SIZE 262144
+#define NURSERY_COLLECT_THRESHOLD 245760
+#define INITIAL_REMEMBERED_SIZE 1024
+#define INITIAL_SYMBOL_TABLE_SIZE 1024
+#define INITIAL_GLOBAL_BUCKETS 64
+#define INITIAL_STACK_SIZE 1024
+#define INCREMENTAL_SCAN_BUDGET 512
+#define MAX_GC_THREADS 64
+#define LAB_SIZE 256
+#define INITIAL_GRAY_SIZE 1024
+#define INITIAL_MARK_STACK_SIZE 1024
+#define BITS_PER_WORD (8 * sizeof(unsigned long))
+#define PAUSE_HISTOGRAM_SIZE 24
 #define REGISTERS 200
-#define MEMORY_COLLECT_THRESHOLD 280000
-#define SYMBOL_COLLECT_THRESHOLD 680000
+#define STRING_LENGTH 0
+#define STRING_CHARS 1
+#define ROPE_LEFT 0
+#define ROPE_RIGHT 1
+#define ROPE_LENGTH 2
+#define INITIAL_PRIMITIVE_TABLE_SIZE 64
+#define SNAPSHOT_MAGIC "SICPIMG"
+#define SNAPSHOT_VERSION 2
 
-static cons memory1[MEMORY_SIZE];
-static cons memory2[MEMORY_SIZE];
-static cell stack;
+/*
+ * A space is a virtual address range reserved once with PROT_NONE.
+ * Only the first `committed' bytes are accessible, so a space grows
+ * or shrinks without moving and the pointers into it stay valid.
+ */
+typedef struct space_tag {
+    char *base;
+    size_t reserved;
+    size_t committed;
+} space;
+
+static space memory1;
+static space memory2;
+static space nursery;
+
+/*
+ * The control stack is a C array.  The collectors scan it as a root;
+ * save_registers copies it into a vector only when a continuation is
+ * captured.
+ */
+static cell *stack = NULL;
+static long stack_top = 0;
+static long stack_size = 0;
 
-static char symbol_memory1[SYMBOL_MEMORY_SIZE];
-static char symbol_memory2[SYMBOL_MEMORY_SIZE];
+/*
+ * The positions of the markers on the stack, innermost last, so that a
+ * function returns without searching for its marker.
+ */
+static long *markers = NULL;
+static long marker_count = 0;
+static long marker_size = 0;
 
 static long freep;
 static long scanp;
@@ -32,23 +87,235 @@ static cons *root;
 static cell old;
 static cell newp;
 
-static cons *the_memory = memory1;
-static cons *new_memory = memory2;
-static long symbol_freep = 0;
-static char *the_symbol_memory = symbol_memory1;
-static char *new_symbol_memory = symbol_memory2;
+static space *the_space = &memory1;
+static space *new_space = &memory2;
+static cons *the_memory;
+static cons *new_memory;
+static long memory_size;
+static long memory_collect_threshold;
+
+static enum gc_mode gc_mode = GC_COPYING;
+static space *from_space = NULL;
+static cons *to_memory;
+static int gc_in_progress = FALSE;
+
+/*
+ * Set while a collector runs.  An error then leaves the heap half
+ * collected, so it ends the process even when an error handler is set.
+ */
+static int collecting = FALSE;
+
+/*
+ * Strings longer than SHORT_LENGTH are interned: a SYMBOL cell points at
+ * the name of its entry, so equal strings share one pointer.  The entries
+ * live outside the heap; a full collection marks the ones it reaches and
+ * sweep_symbols frees the rest.
+ */
+typedef struct symbol_entry_tag {
+    struct symbol_entry_tag *next;
+    unsigned long hash;
+    int marked;
+    int permanent;
+    size_t length;
+    char name[];
+} symbol_entry;
+
+static symbol_entry **symbol_table = NULL;
+static long symbol_table_size = 0;
+static long symbol_count = 0;
+static long symbol_table_bytes = 0;
+static long symbol_table_threshold;
+
+/*
+ * Each parallel collector thread copies into its own local allocation
+ * buffer (LAB) in to-space and keeps the conses it copied but has not
+ * scanned yet in a deque; idle threads steal from the top of others'.
+ */
+typedef struct gc_worker_tag {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    cons **gray;
+    long gray_top;
+    long gray_bottom;
+    long gray_size;
+    long lab_free;
+    long lab_limit;
+    long cells_copied;
+} gc_worker;
+
+static int gc_threads = 0;
+static gc_worker gc_workers[MAX_GC_THREADS];
+static int active_workers;
+
+/*
+ * The mark-compact collector keeps one mark bit per cons.  The number of
+ * live conses before each bitmap word doubles as the forwarding table.
+ */
+static unsigned long *mark_bits;
+static long *mark_offsets;
+static cons **mark_stack = NULL;
+static long mark_stack_count = 0;
+static long mark_stack_size = 0;
+
+/*
+ * Telemetry.  A collection may consist of several pauses when it is
+ * incremental; pause_histogram[i] counts pauses of 2^i to 2^(i+1)
+ * microseconds.
+ */
+static int gc_log = FALSE;
+static long gc_count = 0;
+static double gc_total_pause = 0;
+static double gc_max_pause = 0;
+static long gc_total_cells_copied = 0;
+static long gc_total_symbols_freed = 0;
+static double gc_last_survival = 0;
+static long pause_histogram[PAUSE_HISTOGRAM_SIZE];
+static double pause_start;
+static double collection_pause;
+static long collection_cells;
+static long cells_copied;
+static long symbols_freed;
+static cons *nursery_memory = NULL;
+static long nursery_freep = 0;
+static int minor_collection = FALSE;
+static cons **remembered = NULL;
+static long remembered_count = 0;
+static long remembered_size = 0;
+
+/*
+ * Every primitive in the order of creation, so that a snapshot can name
+ * one by its index.
+ */
+static primitive_entry **primitive_table = NULL;
+static long primitive_count = 0;
+static long primitive_table_size = 0;
 
 static push_register push_registers[REGISTERS];
 static relocate_register relocate_registers[REGISTERS];
 static int registers_count = 0;
 
-static char *alloc_symbol(size_t size);
+static size_t round_up(size_t size, size_t unit) {
+    return (size + unit - 1) / unit * unit;
+}
+
+static void reserve_space(space *sp, size_t reserved) {
+    char *base;
+
+    reserved = round_up(reserved, HUGE_PAGE_SIZE);
+    base = mmap(NULL, reserved + HUGE_PAGE_SIZE, PROT_NONE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(base == MAP_FAILED) {
+        PUT_ERROR("Cannot reserve memory -- reserve_space", get_nil());
+    }
+    sp->base = (char *)round_up((size_t)base, HUGE_PAGE_SIZE);
+    sp->reserved = reserved;
+    sp->committed = 0;
+#ifdef MADV_HUGEPAGE
+    madvise(sp->base, sp->reserved, MADV_HUGEPAGE);
+#endif
+}
+
+static int commit_space(space *sp, size_t size) {
+    size = round_up(size, HUGE_PAGE_SIZE);
+    if(size > sp->reserved) {
+        return FALSE;
+    } else if(size > sp->committed) {
+        if(mprotect(sp->base + sp->committed, size - sp->committed, PROT_READ | PROT_WRITE) != 0) {
+            return FALSE;
+        }
+    } else if(size < sp->committed) {
+        madvise(sp->base + size, sp->committed - size, MADV_DONTNEED);
+        mprotect(sp->base + size, sp->committed - size, PROT_NONE);
+    } else {
+        // unchanged
+    }
+    sp->committed = size;
+    return TRUE;
+}
+
+static void refresh_spaces() {
+    the_memory = (cons *)the_space->base;
+    new_memory = (cons *)new_space->base;
+    memory_size = the_space->committed / sizeof(cons);
+}
+
+static cons *alloc_conses(long size);
+static void find_markers();
+static cell read_barrier(cell *slot);
+static int is_heap_string(cell c);
+static long string_length_of(cell s);
+static int equal_strings(cell s1, cell s2);
+
+static int is_young(cons *ptr) {
+    return nursery_memory != NULL && ptr >= nursery_memory && ptr < nursery_memory + NURSERY_SIZE;
+}
+
+static int is_young_cell(cell c) {
+    return CELL_TYPE(c) == POINTER && is_young(CELL_POINTER(c));
+}
+
+/*
+ * Records an old cons which now refers to the nursery, so that a minor
+ * collection can treat it as a root without scanning the old space.
+ */
+static void remember(cons *ptr) {
+    if(remembered_count > 0 && remembered[remembered_count - 1] == ptr) {
+        // already remembered
+    } else {
+        if(remembered_count >= remembered_size) {
+            remembered_size = remembered_size == 0 ? INITIAL_REMEMBERED_SIZE : remembered_size * 2;
+            remembered = realloc(remembered, remembered_size * sizeof(cons *));
+            if(remembered == NULL) {
+                PUT_ERROR("Out of memory -- remember", get_nil());
+            }
+        }
+        remembered[remembered_count++] = ptr;
+    }
+}
+
+static int in_space(space *sp, void *ptr) {
+    return sp != NULL && (char *)ptr >= sp->base && (char *)ptr < sp->base + sp->committed;
+}
+
+static int is_from_space(cons *ptr) {
+    return is_young(ptr) || (!minor_collection && in_space(from_space, ptr));
+}
+
+static void write_barrier(cons *ptr, cell val) {
+    if(gc_mode == GC_GENERATIONAL && !is_young(ptr) && is_young_cell(val)) {
+        remember(ptr);
+    }
+}
+
+/*
+ * A vector is a header cell followed by its elements, packed into
+ * consecutive conses; the header takes the place of the head of the
+ * first one.  The collectors copy and scan it as one object.
+ */
+static long vector_conses(int length) {
+    return (length + 2) / 2;
+}
+
+static long object_conses(cons *ptr) {
+    return CELL_TYPE(ptr->head_cell) == VECTOR ? vector_conses(CELL_VECTOR_LENGTH(ptr->head_cell)) : 1;
+}
+
+/*
+ * The number of elements of the vector at ptr which hold cells; the
+ * characters of a string are skipped by the collectors.
+ */
+static int vector_cells(cons *ptr) {
+    return CELL_VECTOR_KIND(ptr->head_cell) == STRING_VECTOR ? STRING_CHARS : CELL_VECTOR_LENGTH(ptr->head_cell);
+}
+
+static int is_string_header(cell c) {
+    return CELL_TYPE(c) == VECTOR && CELL_VECTOR_KIND(c) == STRING_VECTOR;
+}
 
 extern cell get_pointer(cons *ptr) {
     cell result;
 
-    result.type = POINTER;
-    result.datum.ptr = ptr;
+    CELL_SET_POINTER(result, ptr);
     return result;
 }
 
@@ -63,22 +330,115 @@ extern cell get_nil() {
     return nil;
 }
 
+static symbol_entry *symbol_entry_of(char *name) {
+    return (symbol_entry *)(name - offsetof(symbol_entry, name));
+}
+
+static unsigned long hash_symbol(char *src, size_t len) {
+    unsigned long hash = 14695981039346656037UL;
+    size_t i;
+
+    for(i = 0; i < len; i++) {
+        hash = (hash ^ (unsigned char)src[i]) * 1099511628211UL;
+    }
+    return hash;
+}
+
+static void rehash_symbols(long size) {
+    symbol_entry **table = calloc(size, sizeof(symbol_entry *));
+    symbol_entry *entry;
+    symbol_entry *next;
+    long i;
+
+    if(table == NULL) {
+        PUT_ERROR("Out of memory -- rehash_symbols", get_nil());
+    }
+    for(i = 0; i < symbol_table_size; i++) {
+        for(entry = symbol_table[i]; entry != NULL; entry = next) {
+            next = entry->next;
+            entry->next = table[entry->hash % size];
+            table[entry->hash % size] = entry;
+        }
+    }
+    free(symbol_table);
+    symbol_table = table;
+    symbol_table_size = size;
+}
+
+/*
+ * Returns the name of the entry for the given bytes, creating it when
+ * needed.  Entries found or created during an incremental collection are
+ * marked because the collector may already have scanned their referrers.
+ */
+static char *intern_symbol(char *src, size_t len) {
+    unsigned long hash = hash_symbol(src, len);
+    symbol_entry *entry;
+
+    if(symbol_count >= symbol_table_size) {
+        rehash_symbols(symbol_table_size == 0 ? INITIAL_SYMBOL_TABLE_SIZE : symbol_table_size * 2);
+    }
+    for(entry = symbol_table[hash % symbol_table_size]; entry != NULL; entry = entry->next) {
+        if(entry->hash == hash && entry->length == len && memcmp(entry->name, src, len) == 0) {
+            entry->marked |= gc_in_progress;
+            return entry->name;
+        }
+    }
+    if((entry = malloc(sizeof(symbol_entry) + len + 1)) == NULL) {
+        PUT_ERROR("Out of memory -- intern_symbol", get_nil());
+    }
+    entry->hash = hash;
+    entry->marked = gc_in_progress;
+    entry->permanent = FALSE;
+    entry->length = len;
+    memcpy(entry->name, src, len);
+    entry->name[len] = '\0';
+    entry->next = symbol_table[hash % symbol_table_size];
+    symbol_table[hash % symbol_table_size] = entry;
+    symbol_count++;
+    symbol_table_bytes += sizeof(symbol_entry) + len + 1;
+    return entry->name;
+}
+
+static void mark_symbol(char *name) {
+    __atomic_store_n(&symbol_entry_of(name)->marked, TRUE, __ATOMIC_RELAXED);
+}
+
+static void sweep_symbols() {
+    symbol_entry **link;
+    symbol_entry *entry;
+    long i;
+
+    for(i = 0; i < symbol_table_size; i++) {
+        link = symbol_table + i;
+        while((entry = *link) != NULL) {
+            if(entry->marked || entry->permanent) {
+                entry->marked = FALSE;
+                link = &entry->next;
+            } else {
+                *link = entry->next;
+                symbol_count--;
+                symbol_table_bytes -= sizeof(symbol_entry) + entry->length + 1;
+                symbols_freed++;
+                free(entry);
+            }
+        }
+    }
+}
+
+/*
+ * Short symbols are zero padded so that two of them can be compared as
+ * one word; a string never has both representations.
+ */
 extern cell get_symbol(char *src, int len) {
     cell result;
 
+    len = strnlen(src, len);
     if(len <= SHORT_LENGTH) {
-        result.type = SHORT_SYMBOL;
-        strncpy(result.datum.short_symbol, src, len);
-        result.datum.short_symbol[len] = '\0';
-    } else {
-        result.type = SYMBOL;
-        result.datum.symbol = alloc_symbol(len + 1);
-        if(result.datum.symbol == NULL) {
-            PUT_ERROR("Out of memory -- get_symbol", get_nil());
-        } else {
-            strncpy(result.datum.symbol, src, len);
-            result.datum.symbol[len] = '\0';
-        }
+        CELL_SET_TYPE(result, SHORT_SYMBOL);
+        memset(CELL_SHORT_SYMBOL(result), 0, SHORT_LENGTH + 1);
+        memcpy(CELL_SHORT_SYMBOL(result), src, len);
+    } else {
+        CELL_SET_SYMBOL(result, intern_symbol(src, len));
     }
     return result;
 }
@@ -87,11 +447,33 @@ extern cell get_symbol_len(char *src) {
     return get_symbol(src, strlen(src));
 }
 
+/*
+ * For symbols held in C variables, which the collector cannot see.
+ */
+extern cell get_permanent_symbol(char *src) {
+    cell result = get_symbol_len(src);
+
+    if(CELL_TYPE(result) == SYMBOL) {
+        symbol_entry_of(CELL_SYMBOL(result))->permanent = TRUE;
+    }
+    return result;
+}
+
+extern int eq_symbol(cell c1, cell c2) {
+    if(CELL_TYPE(c1) == SYMBOL && CELL_TYPE(c2) == SYMBOL) {
+        return CELL_SYMBOL(c1) == CELL_SYMBOL(c2);
+    } else if(CELL_TYPE(c1) == SHORT_SYMBOL && CELL_TYPE(c2) == SHORT_SYMBOL) {
+        return memcmp(CELL_SHORT_SYMBOL(c1), CELL_SHORT_SYMBOL(c2), SHORT_LENGTH + 1) == 0;
+    } else {
+        return FALSE;
+    }
+}
+
 extern int equal_symbol(cell c, char *sym) {
-    if(c.type == SYMBOL) {
-        return strcmp(c.datum.symbol, sym) == 0;
-    } else if(c.type == SHORT_SYMBOL) {
-        return strcmp(c.datum.short_symbol, sym) == 0;
+    if(CELL_TYPE(c) == SYMBOL) {
+        return strcmp(CELL_SYMBOL(c), sym) == 0;
+    } else if(CELL_TYPE(c) == SHORT_SYMBOL) {
+        return strcmp(CELL_SHORT_SYMBOL(c), sym) == 0;
     } else {
         PUT_ERROR("Not symbol -- equal_symbol", c);
     }
@@ -102,151 +484,168 @@ static int compare_number(double num1, double num2) {
 }
 
 extern cell compare(cell left, cell right, int (*compare_type)(int)) {
-    if(left.type == SYMBOL && right.type == SHORT_SYMBOL) {
-        return get_number(compare_type(strcmp(left.datum.symbol, right.datum.short_symbol)));
-    } else if(left.type == SHORT_SYMBOL && right.type == SYMBOL) {
-        return get_number(compare_type(strcmp(left.datum.short_symbol, right.datum.symbol)));
-    } else if(left.type != right.type) {
+    if((is_heap_string(left) || is_heap_string(right)) && is_string(left) && is_string(right)) {
+        return get_number(compare_type(strcmp(get_symbol_view(&left).chars, get_symbol_view(&right).chars)));
+    } else if(CELL_TYPE(left) == SYMBOL && CELL_TYPE(right) == SHORT_SYMBOL) {
+        return get_number(compare_type(strcmp(CELL_SYMBOL(left), CELL_SHORT_SYMBOL(right))));
+    } else if(CELL_TYPE(left) == SHORT_SYMBOL && CELL_TYPE(right) == SYMBOL) {
+        return get_number(compare_type(strcmp(CELL_SHORT_SYMBOL(left), CELL_SYMBOL(right))));
+    } else if(CELL_TYPE(left) != CELL_TYPE(right)) {
         PUT_ERROR("Invalid argument compare -- compare_number", get_nil());
-    } else if(left.type == NUMBER) {
-        return get_number(compare_type(compare_number(left.datum.number, right.datum.number)));
-    } else if(left.type == SYMBOL) {
-        return get_number(compare_type(strcmp(left.datum.symbol, right.datum.symbol)));
-    } else if(left.type == SHORT_SYMBOL) {
-        return get_number(compare_type(strcmp(left.datum.short_symbol, right.datum.short_symbol)));
+    } else if(CELL_TYPE(left) == NUMBER) {
+        return get_number(compare_type(compare_number(CELL_NUMBER(left), CELL_NUMBER(right))));
+    } else if(CELL_TYPE(left) == SYMBOL) {
+        return get_number(compare_type(strcmp(CELL_SYMBOL(left), CELL_SYMBOL(right))));
+    } else if(CELL_TYPE(left) == SHORT_SYMBOL) {
+        return get_number(compare_type(strcmp(CELL_SHORT_SYMBOL(left), CELL_SHORT_SYMBOL(right))));
     } else {
         PUT_ERROR("Invalid argument compare -- compare_number", get_nil());
     }
 }
 
 extern cell get_true() {
-    static cell trueval = { TRUE_LITERAL, { NULL } };
+    static cell trueval = CELL_INITIALIZER(TRUE_LITERAL);
 
     return trueval;
 }
 
 extern cell get_false() {
-    static cell falseval = { FALSE_LITERAL, { NULL } };
+    static cell falseval = CELL_INITIALIZER(FALSE_LITERAL);
 
     return falseval;
 }
 
 extern cell get_undefined() {
-    static cell undefval = { UNDEFINED, { NULL } };
+    static cell undefval = CELL_INITIALIZER(UNDEFINED);
 
     return undefval;
 }
 
+/*
+ * Each marker carries a serial of its own, so that a frame which has
+ * returned is never taken for a later one pushed in the same place.
+ */
 static cell get_marker() {
-    static cell markerval = { MARKER, { NULL } };
+    static long serial = 0;
+    cell markerval;
 
+    CELL_SET_MARKER(markerval, ++serial);
     return markerval;
 }
 
 extern cell get_number(double number) {
     cell result;
 
-    result.type = NUMBER;
-    result.datum.number = number;
+    CELL_SET_NUMBER(result, number);
     return result;
 }
 
 extern cell get_continuation(cont_type cont) {
     cell result;
 
-    result.type = CONTINUATION;
-    result.datum.cont = cont;
+    CELL_SET_CONTINUATION(result, cont);
     return result;
 }
 
 extern cell get_none() {
     cell result;
 
-    result.type = NONE;
+    CELL_SET_TYPE(result, NONE);
     return result;
 }
 
-extern cell get_primitive(cell (*primitive)(cell)) {
+static cell make_primitive(array_primitive_type function, list_primitive_type list_function, int arity) {
+    primitive_entry *entry = malloc(sizeof(primitive_entry));
     cell result;
 
-    result.type = PRIMITIVE;
-    result.datum.primitive = primitive;
+    if(entry == NULL) {
+        PUT_ERROR("Out of memory -- make_primitive", get_nil());
+    }
+    entry->function = function;
+    entry->list_function = list_function;
+    entry->arity = arity;
+    if(primitive_count >= primitive_table_size) {
+        primitive_table_size = primitive_table_size == 0 ? INITIAL_PRIMITIVE_TABLE_SIZE : primitive_table_size * 2;
+        primitive_table = realloc(primitive_table, primitive_table_size * sizeof(primitive_entry *));
+        if(primitive_table == NULL) {
+            PUT_ERROR("Out of memory -- make_primitive", get_nil());
+        }
+    }
+    primitive_table[primitive_count++] = entry;
+    CELL_SET_PRIMITIVE(result, entry);
     return result;
 }
 
-extern char *check_and_get_symbol(cell c) {
-    char *r;
+extern cell get_primitive(list_primitive_type function) {
+    return make_primitive(NULL, function, 0);
+}
 
-    if(c.type == SYMBOL) {
-        return c.datum.symbol;
-    } else if(c.type == SHORT_SYMBOL) {
-        r = alloc_symbol(strlen(c.datum.short_symbol) + 1);
-        strcpy(r, c.datum.short_symbol);
-        return r;
-    } else {
-        PUT_ERROR("Not symbol -- check_and_get_symbol", c);
-    }
+extern cell get_array_primitive(array_primitive_type function, int arity) {
+    return make_primitive(function, NULL, arity);
 }
 
 extern double check_and_get_number(cell c) {
-    if(c.type != NUMBER) {
+    if(CELL_TYPE(c) != NUMBER) {
         PUT_ERROR("Not number -- check_and_get_number", c);
     } else {
-        return c.datum.number;
+        return CELL_NUMBER(c);
     }
 }
 
 extern int check_and_get_int(cell c) {
-    if(c.type != NUMBER) {
+    if(CELL_TYPE(c) != NUMBER) {
         PUT_ERROR("Not number -- check_and_get_number", c);
     } else {
-        return (int)c.datum.number;
+        return (int)CELL_NUMBER(c);
     }
 }
 
 extern cons *check_and_get_cons_ptr(cell c) {
-    if(c.type != POINTER) {
+    if(CELL_TYPE(c) != POINTER) {
         PUT_ERROR("Not pointer -- check_and_get_cons_ptr", c);
     } else {
-        return c.datum.ptr;
+        return CELL_POINTER(c);
     }
 }
 
 extern cont_type check_and_get_continuation(cell c) {
-    if(c.type != CONTINUATION) {
+    if(CELL_TYPE(c) != CONTINUATION) {
         PUT_ERROR("Not continuation -- check_and_get_continuation", c);
     } else {
-        return c.datum.cont;
+        return CELL_CONTINUATION(c);
     }
 }
 
 extern int is_null(cell c) {
-    return c.type == POINTER && c.datum.ptr == NULL;
+    return CELL_TYPE(c) == POINTER && CELL_POINTER(c) == NULL;
 }
 
+/*
+ * Heap strings are pointers too, but they are strings to a program.
+ */
 extern int is_pair(cell c) {
-    return c.type == POINTER && c.datum.ptr != NULL;
+    return CELL_TYPE(c) == POINTER && CELL_POINTER(c) != NULL && !is_heap_string(c);
 }
 
 extern int is_none(cell c) {
-    return c.type == NONE;
+    return CELL_TYPE(c) == NONE;
 }
 
 extern int is_primitive_function(cell c) {
-    return c.type == PRIMITIVE;
+    return CELL_TYPE(c) == PRIMITIVE;
 }
 
 extern int is_undefined(cell c) {
-    return c.type == UNDEFINED;
+    return CELL_TYPE(c) == UNDEFINED;
 }
 
 extern int is_falsy(cell c) {
-    return c.type == FALSE_LITERAL ||
+    return CELL_TYPE(c) == FALSE_LITERAL ||
            is_null(c) ||
-           (c.type == NUMBER && c.datum.number == 0) ||
-           (c.type == SYMBOL && strlen(c.datum.symbol) == 0) ||
-           (c.type == SHORT_SYMBOL && strlen(c.datum.short_symbol) == 0) ||
-           c.type == UNDEFINED;
+           (CELL_TYPE(c) == NUMBER && CELL_NUMBER(c) == 0) ||
+           (CELL_TYPE(c) == SHORT_SYMBOL && CELL_SHORT_SYMBOL(c)[0] == '\0') ||
+           (is_heap_string(c) && string_length_of(c) == 0) ||
+           CELL_TYPE(c) == UNDEFINED;
 }
 
 extern int is_truthy(cell c) {
@@ -257,9 +656,70 @@ extern cell pair(cell h, cell t) {
     return get_pointer(alloc_cell(h, t));
 }
 
+extern cell make_vector(int kind, int length) {
+    long size = vector_conses(length);
+    cons *result = alloc_conses(size);
+    cell *elements;
+    long i;
+
+    if(result == NULL) {
+        PUT_ERROR("Out of memory -- make_vector", get_nil());
+    }
+    CELL_SET_VECTOR_HEADER(result->head_cell, length, kind);
+    elements = &result->tail_cell;
+    for(i = 0; i < size * 2 - 1; i++) {
+        elements[i] = get_undefined();
+    }
+    return get_pointer(result);
+}
+
+extern int is_vector(cell c) {
+    return CELL_TYPE(c) == POINTER && CELL_POINTER(c) != NULL && CELL_TYPE(CELL_POINTER(c)->head_cell) == VECTOR;
+}
+
+extern int vector_kind(cell v) {
+    if(!is_vector(v)) {
+        PUT_ERROR("Not vector -- vector_kind", v);
+    } else {
+        return CELL_VECTOR_KIND(CELL_POINTER(v)->head_cell);
+    }
+}
+
+extern int vector_length(cell v) {
+    if(!is_vector(v)) {
+        PUT_ERROR("Not vector -- vector_length", v);
+    } else {
+        return CELL_VECTOR_LENGTH(CELL_POINTER(v)->head_cell);
+    }
+}
+
+extern cell vector_ref(cell v, int i) {
+    if(i < 0 || i >= vector_length(v)) {
+        PUT_ERROR("Index out of range -- vector_ref", get_number(i));
+    } else {
+        return read_barrier(&CELL_POINTER(v)->tail_cell + i);
+    }
+}
+
+extern void vector_set(cell v, int i, cell val) {
+    if(i < 0 || i >= vector_length(v)) {
+        PUT_ERROR("Index out of range -- vector_set", get_number(i));
+    } else {
+        write_barrier(CELL_POINTER(v), val);
+        (&CELL_POINTER(v)->tail_cell)[i] = val;
+    }
+}
+
+/*
+ * Vectors are pointers as pairs are, but their first cell is a header.
+ */
+static int is_cons_pair(cell c) {
+    return CELL_TYPE(c) == POINTER && CELL_POINTER(c) != NULL && !is_vector(c);
+}
+
 extern cell head(cell c) {
-    if(is_pair(c)) {
-        return c.datum.ptr->head_cell;
+    if(is_cons_pair(c)) {
+        return read_barrier(&CELL_POINTER(c)->head_cell);
     } else {
         display(c);
         PUT_ERROR("Not pair -- head", c);
@@ -267,8 +727,8 @@ extern cell head(cell c) {
 }
 
 extern cell tail(cell c) {
-    if(is_pair(c)) {
-        return c.datum.ptr->tail_cell;
+    if(is_cons_pair(c)) {
+        return read_barrier(&CELL_POINTER(c)->tail_cell);
     } else {
         display(c);
         PUT_ERROR("Not pair -- tail", c);
@@ -276,8 +736,9 @@ extern cell tail(cell c) {
 }
 
 extern cell set_head(cell c, cell val) {
-    if(is_pair(c)) {
-        c.datum.ptr->head_cell = val;
+    if(is_cons_pair(c)) {
+        write_barrier(CELL_POINTER(c), val);
+        CELL_POINTER(c)->head_cell = val;
         return get_undefined();
     } else {
         PUT_ERROR("Not pair -- set_head", c);
@@ -285,8 +746,9 @@ extern cell set_head(cell c, cell val) {
 }
 
 extern cell set_tail(cell c, cell val) {
-    if(is_pair(c)) {
-        c.datum.ptr->tail_cell = val;
+    if(is_cons_pair(c)) {
+        write_barrier(CELL_POINTER(c), val);
+        CELL_POINTER(c)->tail_cell = val;
         return get_undefined();
     } else {
         PUT_ERROR("Not pair -- set_tail", c);
@@ -294,429 +756,1452 @@ extern cell set_tail(cell c, cell val) {
 }
 
 static void set_pointer(cell *cell, cons *ptr) {
-    cell->type = POINTER;
-    cell->datum.ptr = ptr;
+    CELL_SET_POINTER(*cell, ptr);
+}
+
+static void ensure_committed(space *sp, long size) {
+    if(sp->committed < size * sizeof(cons) && !commit_space(sp, size * sizeof(cons))) {
+        PUT_ERROR("Out of memory -- ensure_committed", get_nil());
+    }
 }
 
 static void relocate_old_result_in_new(int is_root) {
     cons *oldht;
-    cell *ht;
-    char *newsymbol;
+    long size;
 
-    if(old.type == POINTER && old.datum.ptr != NULL) {
-        oldht = old.datum.ptr;
-        if(oldht->head_cell.type == MOVED) {
+    if(CELL_TYPE(old) == POINTER && CELL_POINTER(old) != NULL && is_from_space(CELL_POINTER(old))) {
+        oldht = CELL_POINTER(old);
+        if(CELL_TYPE(oldht->head_cell) == MOVED) {
             newp = oldht->tail_cell;
         } else {
-            set_pointer(&newp, new_memory + freep);
-            freep++;
-            if(freep >= MEMORY_COLLECT_SIZE) {
-                printf("Out of memory -- cell\n");
-                exit(10);
+            size = object_conses(oldht);
+            if(gc_in_progress && freep + size > memory_size) {
+                // the mutator allocates in to-space as well
+                ensure_committed(the_space, freep + size);
+                refresh_spaces();
             }
-            *newp.datum.ptr = *oldht;
-            oldht->head_cell.type = MOVED;
+            set_pointer(&newp, to_memory + freep);
+            freep += size;
+            cells_copied += size;
+            memcpy(CELL_POINTER(newp), oldht, size * sizeof(cons));
+            CELL_SET_TYPE(oldht->head_cell, MOVED);
             oldht->tail_cell = newp;
         }
-    } else if(old.type == SYMBOL) {
+    } else if(CELL_TYPE(old) == SYMBOL && !minor_collection) {
+        mark_symbol(CELL_SYMBOL(old));
         newp = old;
-        newsymbol = new_symbol_memory + symbol_freep;
-        symbol_freep += strlen(old.datum.symbol) + 1;
-        if(symbol_freep >= SYMBOL_MEMORY_SIZE) {
-            printf("Out of memory -- symbol_cell\n");
-            exit(10);
-        }
-        strcpy(newsymbol, old.datum.symbol);
-        newp.datum.symbol = newsymbol;
     } else {
         newp = old;
     }
 }
 
 extern void display_memory_usage() {
-    printf("%ld/%d used\n", freep, MEMORY_COLLECT_SIZE);
-}
-
-static void gc_collect_inner(cons *root1) {
-    cons *temp;
-    char *symbol_temp;
-
-    root = root1;
-    freep = 0;
-    scanp = 0;
-    symbol_freep = 0;
-    set_pointer(&old, root);
-    relocate_old_result_in_new(0);
-    root = newp.datum.ptr;
-    while(scanp != freep) {
-        old = new_memory[scanp].head_cell;
-        relocate_old_result_in_new(1);
-        new_memory[scanp].head_cell = newp;
-        old = new_memory[scanp].tail_cell;
-        relocate_old_result_in_new(2);
-        new_memory[scanp].tail_cell = newp;
-        scanp++;
+    if(gc_mode == GC_GENERATIONAL) {
+        printf("%ld/%d young, ", nursery_freep, NURSERY_SIZE);
     }
-    temp = the_memory;
-    the_memory = new_memory;
-    new_memory = temp;
-    symbol_temp = the_symbol_memory;
-    the_symbol_memory = new_symbol_memory;
-    new_symbol_memory = symbol_temp;
+    printf("%ld/%ld used\n", freep, memory_collect_threshold);
 }
 
-static cons *alloc_cell_register(cell head_cell, cons *tail_ptr) {
-    int resultptr;
-
-    the_memory[freep].head_cell = head_cell;
-    the_memory[freep].tail_cell = get_pointer(tail_ptr);
-    resultptr = freep++;
-    if(freep >= MEMORY_SIZE) {
-        PUT_ERROR("Internal error -- too many registers", get_nil());
+/*
+ * While an incremental collection is in progress the mutator must only
+ * see to-space data, so every load from the heap forwards what it finds
+ * and writes the forwarded value back into the slot.
+ */
+static cell read_barrier(cell *slot) {
+    if(!gc_in_progress) {
+        // no barrier
+    } else if(CELL_TYPE(*slot) == POINTER && CELL_POINTER(*slot) != NULL && is_from_space(CELL_POINTER(*slot))) {
+        collecting = TRUE;
+        old = *slot;
+        relocate_old_result_in_new(1);
+        *slot = newp;
+        collecting = FALSE;
+    } else if(CELL_TYPE(*slot) == SYMBOL) {
+        mark_symbol(CELL_SYMBOL(*slot));
     } else {
-        return the_memory + resultptr;
+        // nothing to forward
     }
+    return *slot;
 }
 
-extern cons *save_registers() {
-    cons *root_new = NULL;
-    int i;
-
-    root_new = alloc_cell_register(stack, root_new);
-    for(i = 0; i < registers_count; i++) {
-        root_new = alloc_cell_register(push_registers[i](), root_new);
-    }
-    return root_new;
+static void relocate_fields(cons *ptr) {
+    old = ptr->head_cell;
+    relocate_old_result_in_new(1);
+    ptr->head_cell = newp;
+    old = ptr->tail_cell;
+    relocate_old_result_in_new(2);
+    ptr->tail_cell = newp;
 }
 
-extern void restore_registers(cons *root_new) {
+/*
+ * Relocates every field of the object at ptr and returns its size.
+ */
+static long scan_object(cons *ptr) {
+    cell *elements = &ptr->tail_cell;
+    int length;
     int i;
 
-    for(i = registers_count - 1; i >= 0; i--) {
-        relocate_registers[i](root_new->head_cell);
-        if(is_pair(root_new->tail_cell)) {
-            root_new = root_new->tail_cell.datum.ptr;
-        } else {
-            PUT_ERROR("Internal error -- bad register", get_nil());
+    if(CELL_TYPE(ptr->head_cell) == VECTOR) {
+        length = vector_cells(ptr);
+        for(i = 0; i < length; i++) {
+            old = elements[i];
+            relocate_old_result_in_new(2);
+            elements[i] = newp;
         }
+        return object_conses(ptr);
+    } else {
+        relocate_fields(ptr);
+        return 1;
     }
+}
 
-    if(is_null(root_new->tail_cell)) {
-        stack = root_new->head_cell;
-    } else {
-        PUT_ERROR("Internal error -- bad register", get_nil());
+static void scan_to_memory() {
+    while(scanp != freep) {
+        scanp += scan_object(to_memory + scanp);
     }
 }
 
-static void gc_collect() {
-    cons *root_new = NULL;
+static void relocate_stack() {
+    long i;
+
+    for(i = 0; i < stack_top; i++) {
+        old = stack[i];
+        relocate_old_result_in_new(1);
+        stack[i] = newp;
+    }
+}
 
-    root_new = save_registers();
-    gc_collect_inner(root_new);
+static void flip_spaces() {
+    space *temp;
 
-    root_new = root;
-    restore_registers(root_new);
+    temp = the_space;
+    the_space = new_space;
+    new_space = temp;
+    refresh_spaces();
 }
 
-extern void gc_collect_if_possible() {
-    if(freep > MEMORY_COLLECT_THRESHOLD || symbol_freep > SYMBOL_COLLECT_THRESHOLD) {
-        gc_collect();
-    } else {
-        // not collect
+static void gc_collect_inner(cons *root1) {
+    ensure_committed(new_space, freep + nursery_freep);
+    from_space = the_space;
+    to_memory = (cons *)new_space->base;
+    root = root1;
+    freep = 0;
+    scanp = 0;
+    set_pointer(&old, root);
+    relocate_old_result_in_new(0);
+    root = CELL_POINTER(newp);
+    relocate_stack();
+    scan_to_memory();
+    nursery_freep = 0;
+    remembered_count = 0;
+    flip_spaces();
+}
+
+static void push_gray(gc_worker *w, cons *ptr) {
+    pthread_mutex_lock(&w->lock);
+    if(w->gray_bottom >= w->gray_size) {
+        if(w->gray_top > 0) {
+            memmove(w->gray, w->gray + w->gray_top, (w->gray_bottom - w->gray_top) * sizeof(cons *));
+            w->gray_bottom -= w->gray_top;
+            w->gray_top = 0;
+        } else {
+            w->gray_size = w->gray_size == 0 ? INITIAL_GRAY_SIZE : w->gray_size * 2;
+            w->gray = realloc(w->gray, w->gray_size * sizeof(cons *));
+            if(w->gray == NULL) {
+                PUT_ERROR("Out of memory -- push_gray", get_nil());
+            }
+        }
     }
+    w->gray[w->gray_bottom++] = ptr;
+    pthread_mutex_unlock(&w->lock);
 }
 
-extern void add_register(push_register pusher, relocate_register relocater) {
-    if(registers_count < REGISTERS) {
-        push_registers[registers_count] = pusher;
-        relocate_registers[registers_count] = relocater;
-        registers_count++;
-    } else {
-        PUT_ERROR("Internal error -- too many listeners", get_nil());
+static cons *pop_gray(gc_worker *w, int steal) {
+    cons *result = NULL;
+
+    pthread_mutex_lock(&w->lock);
+    if(w->gray_top < w->gray_bottom) {
+        result = steal ? w->gray[w->gray_top++] : w->gray[--w->gray_bottom];
+        if(w->gray_top == w->gray_bottom) {
+            w->gray_top = w->gray_bottom = 0;
+        }
     }
+    pthread_mutex_unlock(&w->lock);
+    return result;
 }
 
-static cons *alloc_cell_inner(cell head_cell, cell tail_cell) {
-    int resultptr;
+static int has_gray() {
+    int i;
 
-    the_memory[freep].head_cell = head_cell;
-    the_memory[freep].tail_cell = tail_cell;
-    resultptr = freep++;
-    if(freep >= MEMORY_COLLECT_SIZE) {
-        return NULL;
-    } else {
-        return the_memory + resultptr;
+    for(i = 0; i < gc_threads; i++) {
+        if(__atomic_load_n(&gc_workers[i].gray_bottom, __ATOMIC_ACQUIRE) > 0) {
+            return TRUE;
+        }
     }
+    return FALSE;
 }
 
-extern cons *alloc_cell(cell head_cell, cell tail_cell) {
+/*
+ * Returns the next cons to scan, stealing when the own deque is empty.
+ * A thread only leaves the active count after finding every deque empty,
+ * so the collection is over when the count drops to zero.
+ */
+static cons *next_gray(gc_worker *w) {
     cons *result;
+    int i;
 
-    if((result = alloc_cell_inner(head_cell, tail_cell)) != NULL) {
+    if((result = pop_gray(w, FALSE)) != NULL) {
         return result;
-    } else {
-        PUT_ERROR("Out of memory -- alloc_cell", get_nil());
+    }
+    while(TRUE) {
+        for(i = 0; i < gc_threads; i++) {
+            if((result = pop_gray(gc_workers + (w - gc_workers + i) % gc_threads, TRUE)) != NULL) {
+                return result;
+            }
+        }
+        __atomic_sub_fetch(&active_workers, 1, __ATOMIC_SEQ_CST);
+        while(!has_gray()) {
+            if(__atomic_load_n(&active_workers, __ATOMIC_SEQ_CST) == 0) {
+                return NULL;
+            }
+            sched_yield();
+        }
+        __atomic_add_fetch(&active_workers, 1, __ATOMIC_SEQ_CST);
     }
 }
 
-static char *alloc_symbol_inner(size_t size) {
-    char *result = the_symbol_memory + symbol_freep;
+/*
+ * A vector which does not fit in the rest of the LAB is allocated
+ * directly, so the LAB is never abandoned with a hole in it.
+ */
+static cons *alloc_lab(gc_worker *w, long size) {
+    cons *result;
 
-    if(symbol_freep + size < SYMBOL_MEMORY_SIZE) {
-        symbol_freep += size;
-        return result;
+    if(w->lab_free + size <= w->lab_limit) {
+        // fits
+    } else if(size > 1) {
+        return to_memory + __atomic_fetch_add(&freep, size, __ATOMIC_RELAXED);
     } else {
-        return NULL;
+        w->lab_free = __atomic_fetch_add(&freep, LAB_SIZE, __ATOMIC_RELAXED);
+        w->lab_limit = w->lab_free + LAB_SIZE;
     }
+    result = to_memory + w->lab_free;
+    w->lab_free += size;
+    return result;
 }
 
-static char *alloc_symbol(size_t size) {
-    char *result;
-
-    if((result = alloc_symbol_inner(size)) != NULL) {
-        return result;
+/*
+ * Thread-safe counterpart of relocate_old_result_in_new.  The thread
+ * which manages to swap the head type for BUSY copies the cons and then
+ * publishes the forwarding pointer by storing MOVED; the others wait.
+ */
+static cell relocate_parallel(gc_worker *w, cell c) {
+    cons *from;
+    cons *to;
+    cell_tag_word word;
+    cell head;
+    long size;
+
+    if(CELL_TYPE(c) == POINTER && CELL_POINTER(c) != NULL) {
+        from = CELL_POINTER(c);
+        word = __atomic_load_n(&CELL_TAG_WORD(from->head_cell), __ATOMIC_ACQUIRE);
+        while(TRUE) {
+            if(TAG_WORD_TYPE(word) == MOVED) {
+                return from->tail_cell;
+            } else if(TAG_WORD_TYPE(word) == BUSY) {
+                word = __atomic_load_n(&CELL_TAG_WORD(from->head_cell), __ATOMIC_ACQUIRE);
+            } else if(__atomic_compare_exchange_n(&CELL_TAG_WORD(from->head_cell), &word, TYPE_TAG_WORD(BUSY),
+                                                  FALSE, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                head = from->head_cell;
+                CELL_TAG_WORD(head) = word;
+                size = TAG_WORD_TYPE(word) == VECTOR ? vector_conses(CELL_VECTOR_LENGTH(head)) : 1;
+                to = alloc_lab(w, size);
+                w->cells_copied += size;
+                to->head_cell = head;
+                to->tail_cell = from->tail_cell;
+                memcpy(to + 1, from + 1, (size - 1) * sizeof(cons));
+                set_pointer(&from->tail_cell, to);
+                __atomic_store_n(&CELL_TAG_WORD(from->head_cell), TYPE_TAG_WORD(MOVED), __ATOMIC_RELEASE);
+                push_gray(w, to);
+                return get_pointer(to);
+            } else {
+                // lost the race; type has been reloaded
+            }
+        }
+    } else if(CELL_TYPE(c) == SYMBOL) {
+        mark_symbol(CELL_SYMBOL(c));
+        return c;
     } else {
-        PUT_ERROR("Out of memory -- alloc_symbol", get_nil());
+        return c;
     }
 }
 
-extern void save(cell to_push) {
-    stack = pair(to_push, stack);
-}
+static void *gc_worker_main(void *arg) {
+    gc_worker *w = arg;
+    cons *ptr;
+    cell *elements;
+    int i;
 
-extern void save_cons(cons *to_push) {
-    save(get_pointer(to_push));
+    while((ptr = next_gray(w)) != NULL) {
+        if(CELL_TYPE(ptr->head_cell) == VECTOR) {
+            elements = &ptr->tail_cell;
+            for(i = 0; i < vector_cells(ptr); i++) {
+                elements[i] = relocate_parallel(w, elements[i]);
+            }
+        } else {
+            ptr->head_cell = relocate_parallel(w, ptr->head_cell);
+            ptr->tail_cell = relocate_parallel(w, ptr->tail_cell);
+        }
+    }
+    return NULL;
 }
 
-extern void save_continuation(cont_type to_push) {
-    save(get_continuation(to_push));
-}
+static void gc_parallel_inner(cons *root1) {
+    int i;
+    long j;
 
-static void check_not_empty() {
-    if(is_null(stack)) {
-        PUT_ERROR("stack underflow -- check_not_empty", get_nil());
+    ensure_committed(new_space, freep + nursery_freep + (long)gc_threads * LAB_SIZE);
+    to_memory = (cons *)new_space->base;
+    freep = 0;
+    for(i = 0; i < gc_threads; i++) {
+        pthread_mutex_init(&gc_workers[i].lock, NULL);
+        gc_workers[i].lab_free = gc_workers[i].lab_limit = 0;
+        gc_workers[i].cells_copied = 0;
+    }
+    active_workers = gc_threads;
+    root = CELL_POINTER(relocate_parallel(gc_workers, get_pointer(root1)));
+    for(j = 0; j < stack_top; j++) {
+        stack[j] = relocate_parallel(gc_workers, stack[j]);
+    }
+    for(i = 1; i < gc_threads; i++) {
+        if(pthread_create(&gc_workers[i].thread, NULL, gc_worker_main, gc_workers + i) != 0) {
+            PUT_ERROR("Cannot create thread -- gc_parallel_inner", get_nil());
+        }
+    }
+    gc_worker_main(gc_workers);
+    for(i = 1; i < gc_threads; i++) {
+        pthread_join(gc_workers[i].thread, NULL);
+    }
+    for(i = 0; i < gc_threads; i++) {
+        for(; gc_workers[i].lab_free < gc_workers[i].lab_limit; gc_workers[i].lab_free++) {
+            to_memory[gc_workers[i].lab_free].head_cell = get_none();
+            to_memory[gc_workers[i].lab_free].tail_cell = get_none();
+        }
+        cells_copied += gc_workers[i].cells_copied;
+        pthread_mutex_destroy(&gc_workers[i].lock);
     }
+    nursery_freep = 0;
+    remembered_count = 0;
+    flip_spaces();
 }
 
-extern cell restore() {
-    cell result = head(stack);
+static int test_and_set_bit(unsigned long *bits, long i) {
+    unsigned long mask = 1UL << (i % BITS_PER_WORD);
+    int result = (bits[i / BITS_PER_WORD] & mask) != 0;
 
-    stack = tail(stack);
+    bits[i / BITS_PER_WORD] |= mask;
     return result;
 }
 
-extern cons *restore_cons() {
-    return check_and_get_cons_ptr(restore());
+static void push_mark(cons *ptr) {
+    if(mark_stack_count >= mark_stack_size) {
+        mark_stack_size = mark_stack_size == 0 ? INITIAL_MARK_STACK_SIZE : mark_stack_size * 2;
+        mark_stack = realloc(mark_stack, mark_stack_size * sizeof(cons *));
+        if(mark_stack == NULL) {
+            PUT_ERROR("Out of memory -- push_mark", get_nil());
+        }
+    }
+    mark_stack[mark_stack_count++] = ptr;
 }
 
-extern cont_type restore_continuation() {
-    return check_and_get_continuation(restore());
+/*
+ * Every cons of a vector is marked, so that the live counts and the
+ * sliding treat it as consecutive conses.
+ */
+static void mark_cell(cell c) {
+    long i;
+    long size;
+
+    if(CELL_TYPE(c) == POINTER && CELL_POINTER(c) != NULL) {
+        if(!test_and_set_bit(mark_bits, CELL_POINTER(c) - the_memory)) {
+            size = object_conses(CELL_POINTER(c));
+            for(i = 1; i < size; i++) {
+                test_and_set_bit(mark_bits, CELL_POINTER(c) - the_memory + i);
+            }
+            push_mark(CELL_POINTER(c));
+        }
+    } else if(CELL_TYPE(c) == SYMBOL) {
+        mark_symbol(CELL_SYMBOL(c));
+    }
 }
 
-extern void push_marker_to_stack() {
-    save(get_marker());
+static void mark_from(cons *root1) {
+    cons *ptr;
+    cell *elements;
+    long i;
+
+    mark_cell(get_pointer(root1));
+    for(i = 0; i < stack_top; i++) {
+        mark_cell(stack[i]);
+    }
+    while(mark_stack_count > 0) {
+        ptr = mark_stack[--mark_stack_count];
+        if(CELL_TYPE(ptr->head_cell) == VECTOR) {
+            elements = &ptr->tail_cell;
+            for(i = 0; i < vector_cells(ptr); i++) {
+                mark_cell(elements[i]);
+            }
+        } else {
+            mark_cell(ptr->head_cell);
+            mark_cell(ptr->tail_cell);
+        }
+    }
 }
 
-extern void revert_stack_to_marker() {
-    cell r;
+static long compute_offsets(long words) {
+    long live = 0;
+    long w;
 
-    while((r = restore()).type != MARKER) {
+    for(w = 0; w < words; w++) {
+        mark_offsets[w] = live;
+        live += __builtin_popcountl(mark_bits[w]);
     }
+    return live;
+}
+
+static cons *forward_cons(cons *ptr) {
+    long i = ptr - the_memory;
+    unsigned long below = mark_bits[i / BITS_PER_WORD] & ((1UL << (i % BITS_PER_WORD)) - 1);
+
+    return the_memory + mark_offsets[i / BITS_PER_WORD] + __builtin_popcountl(below);
+}
+
+static void forward_cell(cell *c) {
+    if(CELL_TYPE(*c) == POINTER && CELL_POINTER(*c) != NULL) {
+        CELL_SET_POINTER(*c, forward_cons(CELL_POINTER(*c)));
+    }
+}
+
+/*
+ * Sliding mark-compact collection over the single current space: mark,
+ * compute forwarding addresses from the bitmaps, update every pointer
+ * while the old layout is still intact and finally slide the live conses
+ * down in address order.
+ */
+static void gc_compact_inner(cons *root1) {
+    long words = freep / BITS_PER_WORD + 1;
+    long live;
+    long w;
+    long i;
+    long skip = 0;
+    unsigned long bits;
+
+    mark_bits = calloc(words, sizeof(unsigned long));
+    mark_offsets = malloc(words * sizeof(long));
+    if(mark_bits == NULL || mark_offsets == NULL) {
+        PUT_ERROR("Out of memory -- gc_compact_inner", get_nil());
+    }
+    mark_from(root1);
+    live = compute_offsets(words);
+    for(w = 0; w < words; w++) {
+        for(bits = mark_bits[w]; bits != 0; bits &= bits - 1) {
+            i = w * BITS_PER_WORD + __builtin_ctzl(bits);
+            if(i < skip) {
+                // characters of a string
+            } else {
+                forward_cell(&the_memory[i].head_cell);
+                forward_cell(&the_memory[i].tail_cell);
+                if(is_string_header(the_memory[i].head_cell)) {
+                    skip = i + object_conses(&the_memory[i]);
+                }
+            }
+        }
+    }
+    root = forward_cons(root1);
+    for(i = 0; i < stack_top; i++) {
+        forward_cell(&stack[i]);
+    }
+    freep = 0;
+    for(w = 0; w < words; w++) {
+        for(bits = mark_bits[w]; bits != 0; bits &= bits - 1) {
+            the_memory[freep++] = the_memory[w * BITS_PER_WORD + __builtin_ctzl(bits)];
+        }
+    }
+    if(freep != live) {
+        PUT_ERROR("Internal error -- gc_compact_inner", get_nil());
+    }
+    cells_copied = live;
+    free(mark_bits);
+    free(mark_offsets);
+}
+
+static long heap_size_for(long live, long initial, long max) {
+    long size = live * HEAP_GROWTH_FACTOR;
+
+    return size < initial ? initial : size > max ? max : size;
 }
 
-static cell lookup_variable_value1(char *sym, cell env) {
-    if(is_null(env)) {
-        return get_none();
-    } else if(!is_pair(head(env))) {
-        PUT_ERROR("Internal error -- lookup_variable_value1", head(env));
-    } else if(head(head(env)).type != SYMBOL && head(head(env)).type != SHORT_SYMBOL) {
-        PUT_ERROR("Not symbol -- lookup_variable_value1", head(head(env)));
-    } else if(equal_symbol(head(head(env)), sym)) {
-        return tail(head(env));
+/*
+ * Resizes both semi-spaces after a collection so that the next one is
+ * triggered at HEAP_GROWTH_FACTOR times the live size, and likewise for
+ * the symbol table.  Shrinking gives the pages back to the kernel; the
+ * spaces are never moved.
+ */
+static void resize_heap() {
+    long size = heap_size_for(freep, INITIAL_MEMORY_SIZE, MAX_MEMORY_SIZE);
+
+    commit_space(the_space, size * sizeof(cons));
+    if(gc_mode != GC_COMPACT) {
+        commit_space(new_space, size * sizeof(cons));
+    }
+    refresh_spaces();
+    memory_collect_threshold = size;
+    symbol_table_threshold = heap_size_for(symbol_table_bytes, INITIAL_SYMBOL_MEMORY_SIZE, MAX_SYMBOL_MEMORY_SIZE);
+}
+
+/*
+ * Promotes everything reachable from the nursery into the old space.
+ * The roots are the registers and the old conses recorded by
+ * write_barrier; the promoted conses are scanned Cheney-style in place.
+ */
+static void gc_minor_inner(cons *root1) {
+    long i;
+
+    ensure_committed(the_space, freep + nursery_freep);
+    refresh_spaces();
+    to_memory = the_memory;
+    minor_collection = TRUE;
+    scanp = freep;
+    set_pointer(&old, root1);
+    relocate_old_result_in_new(0);
+    root = CELL_POINTER(newp);
+    relocate_stack();
+    for(i = 0; i < remembered_count; i++) {
+        scan_object(remembered[i]);
+    }
+    scan_to_memory();
+    minor_collection = FALSE;
+    nursery_freep = 0;
+    remembered_count = 0;
+    refresh_spaces();
+}
+
+static cons *alloc_cell_register(cell head_cell, cons *tail_ptr) {
+    return alloc_cell(head_cell, get_pointer(tail_ptr));
+}
+
+static void grow_stack(long size) {
+    while(stack_size < size) {
+        stack_size = stack_size == 0 ? INITIAL_STACK_SIZE : stack_size * 2;
+    }
+    stack = realloc(stack, stack_size * sizeof(cell));
+    if(stack == NULL) {
+        PUT_ERROR("Out of memory -- grow_stack", get_nil());
+    }
+}
+
+static cell copy_stack() {
+    cell result = make_vector(STACK_VECTOR, stack_top);
+    long i;
+
+    for(i = 0; i < stack_top; i++) {
+        vector_set(result, i, stack[i]);
+    }
+    return result;
+}
+
+static void restore_stack(cell saved) {
+    long length = vector_length(saved);
+    long i;
+
+    if(length > stack_size) {
+        grow_stack(length);
+    }
+    for(i = 0; i < length; i++) {
+        stack[i] = vector_ref(saved, i);
+    }
+    stack_top = length;
+    find_markers();
+}
+
+/*
+ * The registers are chained in conses ending with saved_stack, which is
+ * nil when the collector saves them since it scans the stack itself.
+ */
+static cons *save_register_chain(cell saved_stack) {
+    cons *root_new = NULL;
+    int i;
+
+    root_new = alloc_cell_register(saved_stack, root_new);
+    for(i = 0; i < registers_count; i++) {
+        root_new = alloc_cell_register(push_registers[i](), root_new);
+    }
+    return root_new;
+}
+
+static cell restore_register_chain(cons *root_new) {
+    int i;
+
+    for(i = registers_count - 1; i >= 0; i--) {
+        relocate_registers[i](read_barrier(&root_new->head_cell));
+        if(is_pair(read_barrier(&root_new->tail_cell))) {
+            root_new = CELL_POINTER(root_new->tail_cell);
+        } else {
+            PUT_ERROR("Internal error -- bad register", get_nil());
+        }
+    }
+
+    if(is_null(root_new->tail_cell)) {
+        return read_barrier(&root_new->head_cell);
     } else {
-        return lookup_variable_value1(sym, tail(env));
+        PUT_ERROR("Internal error -- bad register", get_nil());
+    }
+}
+
+extern cons *save_registers() {
+    return save_register_chain(copy_stack());
+}
+
+extern void restore_registers(cons *root_new) {
+    restore_stack(restore_register_chain(root_new));
+}
+
+static double now_ms() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void start_pause() {
+    pause_start = now_ms();
+}
+
+static void end_pause() {
+    double pause = now_ms() - pause_start;
+    long us = (long)(pause * 1e3);
+    int bucket = 0;
+
+    while(us > 1 && bucket < PAUSE_HISTOGRAM_SIZE - 1) {
+        us >>= 1;
+        bucket++;
+    }
+    pause_histogram[bucket]++;
+    collection_pause += pause;
+    gc_total_pause += pause;
+    gc_max_pause = pause > gc_max_pause ? pause : gc_max_pause;
+}
+
+static void start_collection(long cells) {
+    collection_pause = 0;
+    collection_cells = cells;
+    cells_copied = 0;
+    symbols_freed = 0;
+}
+
+static void finish_collection(char *kind) {
+    gc_count++;
+    gc_total_cells_copied += cells_copied;
+    gc_total_symbols_freed += symbols_freed;
+    gc_last_survival = collection_cells > 0 ? (double)cells_copied / collection_cells : 0;
+    if(gc_log) {
+        fprintf(stderr, "gc #%ld %s: pause %.3f ms, %ld cells copied (%.1f%% survived), "
+                        "%ld symbols freed, heap %ld/%ld cells\n",
+                gc_count, kind, collection_pause, cells_copied, gc_last_survival * 100,
+                symbols_freed, freep, memory_collect_threshold);
     }
 }
 
-extern cell lookup_variable_value_inner(char *sym, cell env) {
-    cell r;
+static void gc_collect() {
+    cons *root_new = NULL;
 
-    if(is_null(env)) {
-        PUT_ERROR("Unbound symbol -- lookup_variable_value_inner", env);
-    } else if(!is_pair(head(env))) {
-        return lookup_variable_value_inner(sym, tail(env));
+    start_pause();
+    start_collection(freep + nursery_freep);
+    root_new = save_register_chain(get_nil());
+    if(gc_mode == GC_PARALLEL && gc_threads > 1) {
+        gc_parallel_inner(root_new);
+    } else if(gc_mode == GC_COMPACT) {
+        gc_compact_inner(root_new);
     } else {
-        r = lookup_variable_value1(sym, head(env));
-        return r.type == NONE ? lookup_variable_value_inner(sym, tail(env)) : r;
+        gc_collect_inner(root_new);
     }
+    sweep_symbols();
+
+    root_new = root;
+    restore_register_chain(root_new);
+    resize_heap();
+    end_pause();
+    finish_collection("full");
+}
+
+static void gc_collect_minor() {
+    cons *root_new = NULL;
+
+    start_pause();
+    start_collection(nursery_freep);
+    root_new = save_register_chain(get_nil());
+    gc_minor_inner(root_new);
+
+    root_new = root;
+    restore_register_chain(root_new);
+    end_pause();
+    finish_collection("minor");
 }
 
-extern cell lookup_variable_value(char *sym, cons *env) {
-    return lookup_variable_value_inner(sym, get_pointer(env));
+/*
+ * Starts an incremental collection: flips the spaces and evacuates only
+ * the registers.  The rest of the live data is copied by
+ * gc_step_incremental or on demand by read_barrier.
+ */
+static void gc_start_incremental() {
+    cons *root_new = NULL;
+
+    start_pause();
+    start_collection(freep);
+    root_new = save_register_chain(get_nil());
+    ensure_committed(new_space, freep);
+    from_space = the_space;
+    flip_spaces();
+    to_memory = the_memory;
+    freep = 0;
+    scanp = 0;
+    gc_in_progress = TRUE;
+    set_pointer(&old, root_new);
+    relocate_old_result_in_new(0);
+    root_new = CELL_POINTER(newp);
+    relocate_stack();
+    restore_register_chain(root_new);
+    end_pause();
 }
 
-static int assign_symbol_value1(char *sym, cell val, cell env) {
-    if(is_null(env)) {
-        return FALSE;
-    } else if(!is_pair(env)) {
-        PUT_ERROR("Internal error -- assign_symbol_value1", env);
-    } else if(!is_pair(head(env))) {
-        PUT_ERROR("Internal error -- assign_symbol_value1", head(env));
-    } else if(head(head(env)).type != SYMBOL && head(head(env)).type != SHORT_SYMBOL) {
-        PUT_ERROR("Internal error -- assign_symbol_value1", head(head(env)));
-    } else if(equal_symbol(head(head(env)), sym)) {
-        set_tail(head(env), val);
+static void gc_step_incremental() {
+    long budget = INCREMENTAL_SCAN_BUDGET;
+
+    start_pause();
+    while(scanp != freep && budget > 0) {
+        scanp += scan_object(to_memory + scanp);
+        budget--;
+    }
+    if(scanp == freep) {
+        gc_in_progress = FALSE;
+        from_space = NULL;
+        sweep_symbols();
+        resize_heap();
+        end_pause();
+        finish_collection("incremental");
+    } else {
+        end_pause();
+    }
+}
+
+static int is_heap_exhausted() {
+    return freep > memory_collect_threshold ||
+           symbol_table_bytes > symbol_table_threshold;
+}
+
+extern void gc_collect_if_possible() {
+    collecting = TRUE;
+    if(gc_mode == GC_INCREMENTAL) {
+        if(gc_in_progress) {
+            gc_step_incremental();
+        } else if(is_heap_exhausted()) {
+            gc_start_incremental();
+        } else {
+            // not collect
+        }
+    } else {
+        if(gc_mode == GC_GENERATIONAL && nursery_freep > NURSERY_COLLECT_THRESHOLD) {
+            gc_collect_minor();
+        }
+        if(is_heap_exhausted()) {
+            gc_collect();
+        } else {
+            // not collect
+        }
+    }
+    collecting = FALSE;
+}
+
+static cell histogram_to_list(int i) {
+    return i >= PAUSE_HISTOGRAM_SIZE
+           ? get_nil()
+           : pair(get_number(pause_histogram[i]), histogram_to_list(i + 1));
+}
+
+static cell stat_entry(char *name, cell value, cell rest) {
+    return pair(pair(get_symbol_len(name), value), rest);
+}
+
+extern cell gc_stats() {
+    return stat_entry("collections", get_number(gc_count),
+           stat_entry("total_pause_ms", get_number(gc_total_pause),
+           stat_entry("max_pause_ms", get_number(gc_max_pause),
+           stat_entry("cells_copied", get_number(gc_total_cells_copied),
+           stat_entry("symbols_freed", get_number(gc_total_symbols_freed),
+           stat_entry("last_survival_rate", get_number(gc_last_survival),
+           stat_entry("pause_histogram_us", histogram_to_list(0),
+           get_nil())))))));
+}
+
+extern void set_gc_mode(enum gc_mode mode) {
+    gc_mode = mode;
+}
+
+extern void set_gc_threads(int threads) {
+    if(threads < 1 || threads > MAX_GC_THREADS) {
+        PUT_ERROR("Invalid number of threads -- set_gc_threads", get_number(threads));
+    } else {
+        gc_threads = threads;
+    }
+}
+
+/*
+ * Sets the collector from a --gc= or --gc-threads= command line option,
+ * returning FALSE for any other option.
+ */
+extern int set_gc_option(char *option) {
+    if(strcmp(option, "--gc=copying") == 0) {
+        set_gc_mode(GC_COPYING);
+        return TRUE;
+    } else if(strcmp(option, "--gc=generational") == 0) {
+        set_gc_mode(GC_GENERATIONAL);
+        return TRUE;
+    } else if(strcmp(option, "--gc=incremental") == 0) {
+        set_gc_mode(GC_INCREMENTAL);
+        return TRUE;
+    } else if(strcmp(option, "--gc=parallel") == 0) {
+        set_gc_mode(GC_PARALLEL);
+        return TRUE;
+    } else if(strcmp(option, "--gc=compact") == 0) {
+        set_gc_mode(GC_COMPACT);
+        return TRUE;
+    } else if(strncmp(option, "--gc-threads=", 13) == 0) {
+        set_gc_threads(atoi(option + 13));
         return TRUE;
     } else {
-        return assign_symbol_value1(sym, val, tail(env));
+        return FALSE;
     }
 }
 
-extern void assign_symbol_value_inner(char *sym, cell val, cell env) {
-    if(is_null(env)) {
-        PUT_ERROR("Unbound symbol -- assign_symbol_value_inner", env);
-    } else if(!is_pair(env)) {
-        PUT_ERROR("Internal error -- assign_symbol_value_inner", env);
-    } else if(!is_pair(head(env))) {
-        assign_symbol_value_inner(sym, val, tail(env));
-    } else if(!assign_symbol_value1(sym, val, head(env))) {
-        assign_symbol_value_inner(sym, val, tail(env));
+extern void add_register(push_register pusher, relocate_register relocater) {
+    if(registers_count < REGISTERS) {
+        push_registers[registers_count] = pusher;
+        relocate_registers[registers_count] = relocater;
+        registers_count++;
     } else {
-        // assigned
+        PUT_ERROR("Internal error -- too many listeners", get_nil());
+    }
+}
+
+static cons *alloc_conses(long size) {
+    cons *result;
+
+    if(gc_mode == GC_GENERATIONAL && nursery_freep + size <= NURSERY_SIZE) {
+        result = nursery_memory + nursery_freep;
+        nursery_freep += size;
+        return result;
+    }
+    if(freep + size > memory_size) {
+        if(!commit_space(the_space, (freep + size) * sizeof(cons))) {
+            return NULL;
+        }
+        refresh_spaces();
     }
+    result = the_memory + freep;
+    freep += size;
+    return result;
 }
 
-extern void assign_symbol_value(char *sym, cell val, cons *env) {
-    assign_symbol_value_inner(sym, val, get_pointer(env));
+static cons *alloc_cell_inner(cell head_cell, cell tail_cell) {
+    cons *result;
+
+    if((result = alloc_conses(1)) == NULL) {
+        return NULL;
+    }
+    write_barrier(result, head_cell);
+    write_barrier(result, tail_cell);
+    result->head_cell = head_cell;
+    result->tail_cell = tail_cell;
+    return result;
 }
 
-static cell int_env(cell unev, cell argl) {
-    cell r;
+extern cons *alloc_cell(cell head_cell, cell tail_cell) {
+    cons *result;
 
-    if(is_null(unev) && is_null(argl)) {
-        return get_nil();
-    } else if(is_pair(unev) && is_pair(argl)) {
-        r = int_env(tail(unev), tail(argl));
-        return pair(pair(head(unev), head(argl)), r);
+    if((result = alloc_cell_inner(head_cell, tail_cell)) != NULL) {
+        return result;
     } else {
-        PUT_ERROR("Internal error -- int_env", get_nil());
+        PUT_ERROR("Out of memory -- alloc_cell", get_nil());
+    }
+}
+
+extern void save(cell to_push) {
+    if(stack_top >= stack_size) {
+        grow_stack(stack_top + 1);
+    }
+    stack[stack_top++] = to_push;
+}
+
+extern void save_cons(cons *to_push) {
+    save(get_pointer(to_push));
+}
+
+extern void save_continuation(cont_type to_push) {
+    save(get_continuation(to_push));
+}
+
+static void check_not_empty() {
+    if(stack_top == 0) {
+        PUT_ERROR("stack underflow -- check_not_empty", get_nil());
+    }
+}
+
+extern cell restore() {
+    check_not_empty();
+    return stack[--stack_top];
+}
+
+/*
+ * The top count cells of the stack, oldest first.  The evaluator pushes
+ * the arguments of an application there and passes them to primitives
+ * in place.
+ */
+extern cell *stack_arguments(int count) {
+    if(stack_top < count) {
+        PUT_ERROR("stack underflow -- stack_arguments", get_nil());
+    }
+    return stack + stack_top - count;
+}
+
+extern void drop_stack(int count) {
+    stack_top -= count;
+}
+
+extern cons *restore_cons() {
+    return check_and_get_cons_ptr(restore());
+}
+
+extern cont_type restore_continuation() {
+    return check_and_get_continuation(restore());
+}
+
+static void add_marker(long position) {
+    if(marker_count >= marker_size) {
+        marker_size = marker_size == 0 ? INITIAL_STACK_SIZE : marker_size * 2;
+        markers = realloc(markers, marker_size * sizeof(long));
+        if(markers == NULL) {
+            PUT_ERROR("Out of memory -- add_marker", get_nil());
+        }
+    }
+    markers[marker_count++] = position;
+}
+
+/*
+ * Finds the markers again after the whole stack has been replaced.
+ */
+static void find_markers() {
+    long i;
+
+    marker_count = 0;
+    for(i = 0; i < stack_top; i++) {
+        if(CELL_TYPE(stack[i]) == MARKER) {
+            add_marker(i);
+        }
+    }
+}
+
+extern void push_marker_to_stack() {
+    add_marker(stack_top);
+    save(get_marker());
+}
+
+extern void revert_stack_to_marker() {
+    if(marker_count == 0) {
+        PUT_ERROR("stack underflow -- revert_stack_to_marker", get_nil());
+    }
+    stack_top = markers[--marker_count];
+}
+
+/*
+ * A frame is named by the index of its marker and the serial of the
+ * marker, and can be reverted to in one step while that very marker is
+ * still on the stack.
+ */
+extern long innermost_frame() {
+    if(marker_count == 0) {
+        PUT_ERROR("No frame -- innermost_frame", get_nil());
     }
+    return marker_count - 1;
+}
+
+extern long frame_serial(long frame) {
+    return CELL_MARKER_SERIAL(stack[markers[frame]]);
+}
+
+extern int revert_stack_to_frame(long frame, long serial) {
+    if(frame < 0 || frame >= marker_count || frame_serial(frame) != serial) {
+        return FALSE;
+    }
+    stack_top = markers[frame];
+    marker_count = frame;
+    return TRUE;
+}
+
+/*
+ * Empties the stack left by a program which has been stopped by an error.
+ */
+extern void reset_stack() {
+    stack_top = 0;
+    marker_count = 0;
+}
+
+/*
+ * Drops what is above the innermost marker and keeps the marker.
+ */
+extern void drop_stack_to_marker() {
+    if(marker_count == 0) {
+        PUT_ERROR("stack underflow -- drop_stack_to_marker", get_nil());
+    }
+    stack_top = markers[marker_count - 1] + 1;
+}
+
+/*
+ * A frame is a vector holding the enclosing environment followed by the
+ * values of the names it was extended with, in the same order.
+ */
+static cell enclosing_frame(cell frame) {
+    return vector_ref(frame, 0);
+}
+
+static cell frame_at(int depth, cons *env) {
+    cell frame = get_pointer(env);
+
+    for(; depth > 0; depth--) {
+        frame = enclosing_frame(frame);
+    }
+    return frame;
+}
+
+extern cell lookup_lexical_value(int depth, int index, cons *env) {
+    return vector_ref(frame_at(depth, env), FRAME_VALUES + index);
+}
+
+extern void assign_lexical_value(int depth, int index, cell val, cons *env) {
+    vector_set(frame_at(depth, env), FRAME_VALUES + index, val);
+}
+
+static int list_length(cell list) {
+    return is_null(list) ? 0 : 1 + list_length(tail(list));
+}
+
+static cell make_frame(int length, cons *env) {
+    cell frame = make_vector(FRAME_VECTOR, FRAME_VALUES + length);
+
+    vector_set(frame, 0, get_pointer(env));
+    return frame;
 }
 
 extern cons *extend_environment(cell unev, cell argl, cons *env) {
-    return alloc_cell(int_env(unev, argl), get_pointer(env));
+    int length = list_length(unev);
+    cell frame;
+    int i;
+
+    if(length != list_length(argl)) {
+        PUT_ERROR("Internal error -- extend_environment", get_nil());
+    }
+    frame = make_frame(length, env);
+    for(i = 0; i < length; i++) {
+        vector_set(frame, FRAME_VALUES + i, head(argl));
+        argl = tail(argl);
+    }
+    return CELL_POINTER(frame);
 }
 
-extern cell apply_primitive_function(cell fun, cell argl) {
-    if(fun.type != PRIMITIVE) {
-        display(head(fun));
-        PUT_ERROR("Not primitive -- apply_primitive_function", fun);
+extern cons *extend_environment_arguments(cell unev, int argc, cell *argv, cons *env) {
+    cell frame;
+    int i;
+
+    if(argc != list_length(unev)) {
+        PUT_ERROR("Internal error -- extend_environment", get_nil());
+    }
+    frame = make_frame(argc, env);
+    for(i = 0; i < argc; i++) {
+        vector_set(frame, FRAME_VALUES + i, argv[i]);
     }
-    return fun.datum.primitive(argl);
+    return CELL_POINTER(frame);
 }
 
-extern cell string_ref(cell c, int i) {
-    char *sym = check_and_get_symbol(c);
+/*
+ * The global environment is the outermost frame.  Instead of values it
+ * holds a hash table of (symbol . value) bindings.  A binding never
+ * moves to another cons, so a caller may keep it and skip the lookup
+ * the next time.
+ */
+static unsigned long hash_symbol_cell(cell sym) {
+    unsigned long word;
+
+    if(CELL_TYPE(sym) == SYMBOL) {
+        return symbol_entry_of(CELL_SYMBOL(sym))->hash;
+    } else if(CELL_TYPE(sym) == SHORT_SYMBOL) {
+        memcpy(&word, CELL_SHORT_SYMBOL(sym), sizeof(word));
+        return (word ^ (word >> 29)) * 0x9E3779B97F4A7C15UL >> 7;
+    } else {
+        PUT_ERROR("Not symbol -- hash_symbol_cell", sym);
+    }
+}
 
-    if(strlen(sym) <= i) {
-        PUT_ERROR("Length too short -- string_ref", get_nil());
+static cell global_buckets(cell global) {
+    return vector_ref(global, 1);
+}
+
+static cell global_bucket(cell sym, cell buckets) {
+    return vector_ref(buckets, hash_symbol_cell(sym) % vector_length(buckets));
+}
+
+static cell find_binding(cell sym, cell bindings) {
+    return is_null(bindings)
+           ? get_nil()
+           : eq_symbol(head(head(bindings)), sym)
+           ? head(bindings)
+           : find_binding(sym, tail(bindings));
+}
+
+static cell global_frame(cons *env) {
+    cell frame = get_pointer(env);
+
+    while(vector_kind(frame) != GLOBAL_VECTOR) {
+        frame = enclosing_frame(frame);
+    }
+    return frame;
+}
+
+extern cons *global_environment(cons *env) {
+    return check_and_get_cons_ptr(global_frame(env));
+}
+
+static void add_binding(cell binding, cell buckets) {
+    long i = hash_symbol_cell(head(binding)) % vector_length(buckets);
+
+    vector_set(buckets, i, pair(binding, vector_ref(buckets, i)));
+}
+
+static void rehash_global(cell global) {
+    cell buckets = global_buckets(global);
+    cell new_buckets = make_vector(TABLE_VECTOR, vector_length(buckets) * 2);
+    cell bindings;
+    int i;
+
+    for(i = 0; i < vector_length(buckets); i++) {
+        vector_set(new_buckets, i, get_nil());
+        vector_set(new_buckets, i + vector_length(buckets), get_nil());
+    }
+    for(i = 0; i < vector_length(buckets); i++) {
+        for(bindings = vector_ref(buckets, i); !is_null(bindings); bindings = tail(bindings)) {
+            add_binding(head(bindings), new_buckets);
+        }
+    }
+    vector_set(global, 1, new_buckets);
+}
+
+extern cell lookup_global_binding(cell sym, cons *env) {
+    cell binding = find_binding(sym, global_bucket(sym, global_buckets(global_frame(env))));
+
+    if(is_null(binding)) {
+        PUT_ERROR("Unbound symbol -- lookup_global_binding", sym);
     } else {
-        return get_symbol(sym + i, 1);
+        return binding;
     }
 }
 
-extern cell string_length(cell c) {
-    char *sym = check_and_get_symbol(c);
+extern void define_global_value(cell sym, cell val, cons *env) {
+    cell global = global_frame(env);
+    cell binding = find_binding(sym, global_bucket(sym, global_buckets(global)));
+    int count;
+
+    if(is_pair(binding)) {
+        set_tail(binding, val);
+    } else {
+        add_binding(pair(sym, val), global_buckets(global));
+        count = check_and_get_int(vector_ref(global, 2)) + 1;
+        vector_set(global, 2, get_number(count));
+        if(count > vector_length(global_buckets(global)) * 2) {
+            rehash_global(global);
+        }
+    }
+}
+
+extern cons *make_global_environment(cell names, cell values) {
+    cell global = make_vector(GLOBAL_VECTOR, 3);
+    cell buckets = make_vector(TABLE_VECTOR, INITIAL_GLOBAL_BUCKETS);
+    int i;
 
-    return get_number(strlen(sym));
+    for(i = 0; i < INITIAL_GLOBAL_BUCKETS; i++) {
+        vector_set(buckets, i, get_nil());
+    }
+    vector_set(global, 0, get_nil());
+    vector_set(global, 1, buckets);
+    vector_set(global, 2, get_number(0));
+    for(; is_pair(names) && is_pair(values); names = tail(names), values = tail(values)) {
+        define_global_value(head(names), head(values), CELL_POINTER(global));
+    }
+    return CELL_POINTER(global);
 }
 
-extern cell string_append(cell s1, cell s2) {
-    char *sym1 = check_and_get_symbol(s1);
-    char *sym2 = check_and_get_symbol(s2);
-    int len = strlen(sym1) + strlen(sym2);
-    char *tmp = malloc(len + 1);
-    cell result;
+static cell arguments_to_list(int argc, cell *argv) {
+    cell result = get_nil();
 
-    sprintf(tmp, "%s%s", sym1, sym2);
-    result = get_symbol(tmp, len);
-    free(tmp);
+    while(argc > 0) {
+        argc--;
+        result = pair(argv[argc], result);
+    }
     return result;
 }
 
-extern cell substring(cell s, int begin, int end) {
-    char *sym = check_and_get_symbol(s);
-    int len = strlen(sym);
+extern cell apply_primitive_function(cell fun, int argc, cell *argv) {
+    primitive_entry *entry;
 
-    if(len <= begin || begin > end) {
-        PUT_ERROR("Invalid range -- substring", get_nil());
+    if(CELL_TYPE(fun) != PRIMITIVE) {
+        display(head(fun));
+        PUT_ERROR("Not primitive -- apply_primitive_function", fun);
+    }
+    entry = CELL_PRIMITIVE(fun);
+    if(argc < entry->arity) {
+        PUT_ERROR("Too few arguments -- apply_primitive_function", get_number(argc));
+    } else if(entry->list_function != NULL) {
+        return entry->list_function(arguments_to_list(argc, argv));
     } else {
-        return get_symbol(sym + begin, end - begin);
+        return entry->function(argc, argv);
     }
 }
 
-extern int char_to_integer(cell s) {
-    char *sym = check_and_get_symbol(s);
+/*
+ * Strings of at most SHORT_LENGTH characters are short symbols.  Longer
+ * ones are STRING_VECTORs holding the length followed by the characters
+ * and a NUL, packed into cells which the collectors copy but never scan.
+ * string_append makes a ROPE_VECTOR of its operands instead, which is
+ * flattened into a string the first time its characters are needed and
+ * then keeps that string as its left part and nil as its right one.
+ * Long symbols are accepted as strings as well.
+ */
+static int is_heap_string(cell c) {
+    return is_vector(c) && (vector_kind(c) == STRING_VECTOR || vector_kind(c) == ROPE_VECTOR);
+}
+
+extern int is_string(cell c) {
+    return CELL_TYPE(c) == SYMBOL || CELL_TYPE(c) == SHORT_SYMBOL || is_heap_string(c);
+}
+
+static int string_cells(long length) {
+    return STRING_CHARS + (length + sizeof(cell)) / sizeof(cell);
+}
+
+static char *string_data(cell s) {
+    return (char *)(&CELL_POINTER(s)->tail_cell + STRING_CHARS);
+}
+
+static cell make_string(long length) {
+    cell result = make_vector(STRING_VECTOR, string_cells(length));
+
+    vector_set(result, STRING_LENGTH, get_number(length));
+    string_data(result)[length] = '\0';
+    return result;
+}
+
+extern cell get_string(char *src, int len) {
+    cell result;
 
-    if(strlen(sym) <= 0) {
-        PUT_ERROR("Length too short -- char_to_integer", s);
+    if(len <= SHORT_LENGTH) {
+        return get_symbol(src, len);
     } else {
-        return sym[0];
+        result = make_string(len);
+        memcpy(string_data(result), src, len);
+        return result;
     }
 }
 
-extern int is_whitespace(cell s) {
-    char *sym = check_and_get_symbol(s);
+static long string_length_of(cell s) {
+    if(CELL_TYPE(s) == SHORT_SYMBOL) {
+        return strlen(CELL_SHORT_SYMBOL(s));
+    } else if(CELL_TYPE(s) == SYMBOL) {
+        return symbol_entry_of(CELL_SYMBOL(s))->length;
+    } else if(!is_heap_string(s)) {
+        PUT_ERROR("Not string -- string_length_of", s);
+    } else if(vector_kind(s) == STRING_VECTOR) {
+        return check_and_get_int(vector_ref(s, STRING_LENGTH));
+    } else {
+        return check_and_get_int(vector_ref(s, ROPE_LENGTH));
+    }
+}
+
+static int is_unflattened_rope(cell s) {
+    return is_vector(s) && vector_kind(s) == ROPE_VECTOR && !is_null(vector_ref(s, ROPE_RIGHT));
+}
+
+/*
+ * Recurses into the shorter part of each rope and loops on the longer
+ * one, so the depth stays logarithmic however the rope was built.
+ */
+static void copy_string_chars(cell s, char *dst) {
+    cell left;
+    cell right;
+    long left_length;
+    symbol_view view;
+
+    while(is_unflattened_rope(s)) {
+        left = vector_ref(s, ROPE_LEFT);
+        right = vector_ref(s, ROPE_RIGHT);
+        left_length = string_length_of(left);
+        if(left_length < string_length_of(right)) {
+            copy_string_chars(left, dst);
+            dst += left_length;
+            s = right;
+        } else {
+            copy_string_chars(right, dst + left_length);
+            s = left;
+        }
+    }
+    view = get_symbol_view(&s);
+    memcpy(dst, view.chars, view.length);
+}
+
+static cell flat_string(cell s) {
+    cell result;
 
-    if(strlen(sym) < 1) {
-        PUT_ERROR("Length too short -- is_whitespace", s);
+    if(vector_kind(s) == STRING_VECTOR) {
+        return s;
+    } else if(!is_unflattened_rope(s)) {
+        return vector_ref(s, ROPE_LEFT);
     } else {
-        return isspace(*sym);
+        result = make_string(string_length_of(s));
+        copy_string_chars(s, string_data(result));
+        vector_set(s, ROPE_LEFT, result);
+        vector_set(s, ROPE_RIGHT, get_nil());
+        return result;
     }
 }
 
-extern int is_alphabetic(cell s) {
-    char *sym = check_and_get_symbol(s);
+/*
+ * Reading a symbol never allocates; a rope is flattened the first time
+ * its characters are asked for.
+ */
+extern symbol_view get_symbol_view(cell *c) {
+    symbol_view view;
+
+    if(CELL_TYPE(*c) == SHORT_SYMBOL) {
+        view.chars = CELL_SHORT_SYMBOL(*c);
+        view.length = strlen(view.chars);
+    } else if(CELL_TYPE(*c) == SYMBOL) {
+        view.chars = CELL_SYMBOL(*c);
+        view.length = symbol_entry_of(view.chars)->length;
+    } else if(is_heap_string(*c)) {
+        view.chars = string_data(flat_string(*c));
+        view.length = string_length_of(*c);
+    } else {
+        PUT_ERROR("Not symbol -- get_symbol_view", *c);
+    }
+    return view;
+}
+
+static int equal_strings(cell s1, cell s2) {
+    symbol_view view1;
+    symbol_view view2;
 
-    if(strlen(sym) < 1) {
-        PUT_ERROR("Length too short -- is_alphabetic", s);
+    if(string_length_of(s1) != string_length_of(s2)) {
+        return FALSE;
     } else {
-        return isalpha(*sym);
+        view1 = get_symbol_view(&s1);
+        view2 = get_symbol_view(&s2);
+        return memcmp(view1.chars, view2.chars, view1.length) == 0;
     }
 }
 
-extern int is_numeric(cell s) {
-    char *sym = check_and_get_symbol(s);
+extern cell string_ref(cell c, int i) {
+    if(i < 0 || string_length_of(c) <= i) {
+        PUT_ERROR("Length too short -- string_ref", get_nil());
+    } else {
+        return get_symbol(get_symbol_view(&c).chars + i, 1);
+    }
+}
+
+extern cell string_length(cell c) {
+    return get_number(string_length_of(c));
+}
+
+extern cell string_append(cell s1, cell s2) {
+    long length1 = string_length_of(s1);
+    long length2 = string_length_of(s2);
+    char buf[SHORT_LENGTH + 1];
+    cell result;
 
-    if(strlen(sym) < 1) {
-        PUT_ERROR("Length too short -- is_numeric", s);
+    if(length1 == 0) {
+        return s2;
+    } else if(length2 == 0) {
+        return s1;
+    } else if(length1 + length2 <= SHORT_LENGTH) {
+        copy_string_chars(s1, buf);
+        copy_string_chars(s2, buf + length1);
+        return get_symbol(buf, length1 + length2);
     } else {
-        return isdigit(*sym);
+        result = make_vector(ROPE_VECTOR, 3);
+        vector_set(result, ROPE_LEFT, s1);
+        vector_set(result, ROPE_RIGHT, s2);
+        vector_set(result, ROPE_LENGTH, get_number(length1 + length2));
+        return result;
     }
 }
 
+extern cell substring(cell s, int begin, int end) {
+    long len = string_length_of(s);
+
+    if(begin < 0 || len <= begin || begin > end) {
+        PUT_ERROR("Invalid range -- substring", get_nil());
+    } else {
+        return get_string(get_symbol_view(&s).chars + begin, (end < len ? end : len) - begin);
+    }
+}
+
+static char first_char(cell s, char *name) {
+    if(string_length_of(s) < 1) {
+        PUT_ERROR(name, s);
+    } else {
+        return get_symbol_view(&s).chars[0];
+    }
+}
+
+extern int char_to_integer(cell s) {
+    return first_char(s, "Length too short -- char_to_integer");
+}
+
+extern int is_whitespace(cell s) {
+    return isspace(first_char(s, "Length too short -- is_whitespace"));
+}
+
+extern int is_alphabetic(cell s) {
+    return isalpha(first_char(s, "Length too short -- is_alphabetic"));
+}
+
+extern int is_numeric(cell s) {
+    return isdigit(first_char(s, "Length too short -- is_numeric"));
+}
+
 extern int eqv(cell c1, cell c2) {
-    if(c1.type == SYMBOL && c2.type == SHORT_SYMBOL) {
-        return strcmp(c1.datum.symbol, c2.datum.short_symbol) == 0;
-    } else if(c1.type == SHORT_SYMBOL && c2.type == SYMBOL) {
-        return strcmp(c1.datum.short_symbol, c2.datum.symbol) == 0;
-    } else if(c1.type != c2.type) {
+    if(is_heap_string(c1) || is_heap_string(c2)) {
+        return is_string(c1) && is_string(c2) && equal_strings(c1, c2);
+    } else if(CELL_TYPE(c1) != CELL_TYPE(c2)) {
         return FALSE;
-    } else if(c1.type == POINTER) {
-        return c1.datum.ptr == c2.datum.ptr;
-    } else if(c1.type == NUMBER) {
-        return c1.datum.number == c2.datum.number;
-    } else if(c1.type == SYMBOL) {
-        return strcmp(c1.datum.symbol, c2.datum.symbol) == 0;
-    } else if(c1.type == SHORT_SYMBOL) {
-        return strcmp(c1.datum.short_symbol, c2.datum.short_symbol) == 0;
-    } else if(c1.type == PRIMITIVE) {
-        return c1.datum.primitive == c2.datum.primitive;
-    } else if(c1.type == TRUE_LITERAL) {
+    } else if(CELL_TYPE(c1) == POINTER) {
+        return CELL_POINTER(c1) == CELL_POINTER(c2);
+    } else if(CELL_TYPE(c1) == NUMBER) {
+        return CELL_NUMBER(c1) == CELL_NUMBER(c2);
+    } else if(CELL_TYPE(c1) == SYMBOL || CELL_TYPE(c1) == SHORT_SYMBOL) {
+        return eq_symbol(c1, c2);
+    } else if(CELL_TYPE(c1) == PRIMITIVE) {
+        return CELL_PRIMITIVE(c1) == CELL_PRIMITIVE(c2);
+    } else if(CELL_TYPE(c1) == TRUE_LITERAL) {
         return TRUE;
-    } else if(c1.type == FALSE_LITERAL) {
+    } else if(CELL_TYPE(c1) == FALSE_LITERAL) {
         return TRUE;
-    } else if(c1.type == UNDEFINED) {
+    } else if(CELL_TYPE(c1) == UNDEFINED) {
         return TRUE;
     } else {
         return TRUE;
@@ -724,7 +2209,11 @@ extern int eqv(cell c1, cell c2) {
 }
 
 static void display_inner(cell to_display) {
-    if(is_pair(to_display)) {
+    if(is_heap_string(to_display)) {
+        printf("%s", get_symbol_view(&to_display).chars);
+    } else if(is_vector(to_display)) {
+        printf("<vector>");
+    } else if(is_pair(to_display)) {
         printf("[");
         display_inner(head(to_display));
         printf(", ");
@@ -732,21 +2221,21 @@ static void display_inner(cell to_display) {
         printf("]");
     } else if(is_null(to_display)) {
         printf("null");
-    } else if(to_display.type == NUMBER) {
-        printf("%lf", to_display.datum.number);
-    } else if(to_display.type == SYMBOL) {
-        printf("%s", to_display.datum.symbol);
-    } else if(to_display.type == SHORT_SYMBOL) {
-        printf("%s", to_display.datum.short_symbol);
-    } else if(to_display.type == PRIMITIVE) {
+    } else if(CELL_TYPE(to_display) == NUMBER) {
+        printf("%lf", CELL_NUMBER(to_display));
+    } else if(CELL_TYPE(to_display) == SYMBOL) {
+        printf("%s", CELL_SYMBOL(to_display));
+    } else if(CELL_TYPE(to_display) == SHORT_SYMBOL) {
+        printf("%s", CELL_SHORT_SYMBOL(to_display));
+    } else if(CELL_TYPE(to_display) == PRIMITIVE) {
         printf("<primitive>");
-    } else if(to_display.type == CONTINUATION) {
+    } else if(CELL_TYPE(to_display) == CONTINUATION) {
         printf("<cont>");
-    } else if(to_display.type == TRUE_LITERAL) {
+    } else if(CELL_TYPE(to_display) == TRUE_LITERAL) {
         printf("true");
-    } else if(to_display.type == FALSE_LITERAL) {
+    } else if(CELL_TYPE(to_display) == FALSE_LITERAL) {
         printf("false");
-    } else if(to_display.type == UNDEFINED) {
+    } else if(CELL_TYPE(to_display) == UNDEFINED) {
         printf("undefined");
     } else {
         printf("<other>");
@@ -761,28 +2250,33 @@ extern void display(cell to_display) {
 static char *display_error(cell to_display) {
     static char buf[1000];
 
-    if(is_pair(to_display)) {
+    if(is_heap_string(to_display)) {
+        snprintf(buf, sizeof(buf), "%s", get_symbol_view(&to_display).chars);
+        return buf;
+    } else if(is_vector(to_display)) {
+        return "<vector>";
+    } else if(is_pair(to_display)) {
         return "<pair>";
     } else if(is_null(to_display)) {
         return "null";
-    } else if(to_display.type == NUMBER) {
-        sprintf(buf, "%lf", to_display.datum.number);
+    } else if(CELL_TYPE(to_display) == NUMBER) {
+        sprintf(buf, "%lf", CELL_NUMBER(to_display));
         return buf;
-    } else if(to_display.type == SYMBOL) {
-        sprintf(buf, "%s", to_display.datum.symbol);
+    } else if(CELL_TYPE(to_display) == SYMBOL) {
+        sprintf(buf, "%s", CELL_SYMBOL(to_display));
         return buf;
-    } else if(to_display.type == SHORT_SYMBOL) {
-        sprintf(buf, "%s", to_display.datum.short_symbol);
+    } else if(CELL_TYPE(to_display) == SHORT_SYMBOL) {
+        sprintf(buf, "%s", CELL_SHORT_SYMBOL(to_display));
         return buf;
-    } else if(to_display.type == PRIMITIVE) {
+    } else if(CELL_TYPE(to_display) == PRIMITIVE) {
         return "<primitive>";
-    } else if(to_display.type == CONTINUATION) {
+    } else if(CELL_TYPE(to_display) == CONTINUATION) {
         return "<cont>";
-    } else if(to_display.type == TRUE_LITERAL) {
+    } else if(CELL_TYPE(to_display) == TRUE_LITERAL) {
         return "true";
-    } else if(to_display.type == FALSE_LITERAL) {
+    } else if(CELL_TYPE(to_display) == FALSE_LITERAL) {
         return "false";
-    } else if(to_display.type == UNDEFINED) {
+    } else if(CELL_TYPE(to_display) == UNDEFINED) {
         return "undefined";
     } else {
         return "<other>";
@@ -790,6 +2284,7 @@ static char *display_error(cell to_display) {
 }
 
 extern void put_error(char *msg, cell obj) {
+    fflush(stdout);
     if(is_null(obj)) {
         fprintf(stderr, "%s\n", msg);
     } else {
@@ -797,7 +2292,295 @@ extern void put_error(char *msg, cell obj) {
     }
 }
 
+/*
+ * A server sets a handler which goes back to its loop of requests.
+ * Without one an error ends the process.
+ */
+static error_handler_type error_handler = NULL;
+
+extern void set_error_handler(error_handler_type handler) {
+    error_handler = handler;
+}
+
+extern void raise_error(int status) {
+    if(error_handler != NULL && !collecting) {
+        error_handler();
+    }
+    exit(status);
+}
+
+/*
+ * A snapshot is the heap after a full collection, the registers and the
+ * stack, followed by the names of the long symbols.  Pointers are kept
+ * as they were with the base of the heap they pointed into, and symbols
+ * and primitives are replaced by their indices in the symbol names and in
+ * primitive_table, so that loading only moves pointers and interns names.
+ */
+typedef struct snapshot_header_tag {
+    char magic[8];
+    long version;
+    long cons_size;
+    long short_length;
+    cons *base;
+    long conses;
+    long registers;
+    long stack_cells;
+    long symbols;
+    long primitives;
+} snapshot_header;
+
+static symbol_entry **snapshot_symbols;
+static char **snapshot_names;
+static cons *snapshot_base;
+
+static int compare_addresses(const void *p1, const void *p2) {
+    return *(char **)p1 < *(char **)p2 ? -1 : *(char **)p1 > *(char **)p2 ? 1 : 0;
+}
+
+static long primitive_index(primitive_entry *entry) {
+    long i;
+
+    for(i = 0; i < primitive_count; i++) {
+        if(primitive_table[i] == entry) {
+            return i;
+        }
+    }
+    PUT_ERROR("Internal error -- primitive_index", get_nil());
+}
+
+static void save_snapshot_cell(cell *c) {
+    symbol_entry *entry;
+
+    if(CELL_TYPE(*c) == SYMBOL) {
+        entry = symbol_entry_of(CELL_SYMBOL(*c));
+        CELL_SET_SYMBOL(*c, (char *)((symbol_entry **)bsearch(&entry, snapshot_symbols, symbol_count,
+                                                             sizeof(symbol_entry *), compare_addresses)
+                                     - snapshot_symbols));
+    } else if(CELL_TYPE(*c) == PRIMITIVE) {
+        CELL_SET_PRIMITIVE(*c, (primitive_entry *)primitive_index(CELL_PRIMITIVE(*c)));
+    } else if(CELL_TYPE(*c) == CONTINUATION && CELL_CONTINUATION(*c) != NULL) {
+        PUT_ERROR("Cannot save a continuation -- save_snapshot", get_nil());
+    } else {
+        // stored as it is
+    }
+}
+
+static void load_snapshot_cell(cell *c) {
+    if(CELL_TYPE(*c) == POINTER && CELL_POINTER(*c) != NULL) {
+        set_pointer(c, the_memory + (CELL_POINTER(*c) - snapshot_base));
+    } else if(CELL_TYPE(*c) == SYMBOL) {
+        CELL_SET_SYMBOL(*c, snapshot_names[(long)CELL_SYMBOL(*c)]);
+    } else if(CELL_TYPE(*c) == PRIMITIVE) {
+        CELL_SET_PRIMITIVE(*c, primitive_table[(long)CELL_PRIMITIVE(*c)]);
+    } else {
+        // nothing to move
+    }
+}
+
+/*
+ * Applies convert to the cells of the conses from 0 to count, skipping
+ * the characters of strings as the collectors do.
+ */
+static void convert_conses(cons *conses, long count, void (*convert)(cell *)) {
+    cell *elements;
+    long i;
+    int length;
+    int j;
+
+    for(i = 0; i < count; i += object_conses(conses + i)) {
+        if(CELL_TYPE(conses[i].head_cell) == VECTOR) {
+            elements = &conses[i].tail_cell;
+            length = vector_cells(conses + i);
+            for(j = 0; j < length; j++) {
+                convert(&elements[j]);
+            }
+        } else {
+            convert(&conses[i].head_cell);
+            convert(&conses[i].tail_cell);
+        }
+    }
+}
+
+static void write_snapshot(FILE *out, void *data, size_t size) {
+    if(fwrite(data, 1, size, out) != size) {
+        PUT_ERROR("Cannot write snapshot -- save_snapshot", get_nil());
+    }
+}
+
+extern void save_snapshot(char *path) {
+    snapshot_header header;
+    cons *heap;
+    cell *cells;
+    symbol_entry *entry;
+    FILE *out;
+    long count;
+    long i;
+
+    while(gc_in_progress) {
+        gc_step_incremental();
+    }
+    gc_collect();
+    snapshot_symbols = malloc((symbol_count + 1) * sizeof(symbol_entry *));
+    heap = malloc((freep + 1) * sizeof(cons));
+    cells = malloc((registers_count + stack_top + 1) * sizeof(cell));
+    if(snapshot_symbols == NULL || heap == NULL || cells == NULL) {
+        PUT_ERROR("Out of memory -- save_snapshot", get_nil());
+    }
+    for(i = 0, count = 0; i < symbol_table_size; i++) {
+        for(entry = symbol_table[i]; entry != NULL; entry = entry->next) {
+            snapshot_symbols[count++] = entry;
+        }
+    }
+    qsort(snapshot_symbols, symbol_count, sizeof(symbol_entry *), compare_addresses);
+    memcpy(heap, the_memory, freep * sizeof(cons));
+    convert_conses(heap, freep, save_snapshot_cell);
+    for(i = 0; i < registers_count; i++) {
+        cells[i] = push_registers[i]();
+    }
+    memcpy(cells + registers_count, stack, stack_top * sizeof(cell));
+    for(i = 0; i < registers_count + stack_top; i++) {
+        save_snapshot_cell(&cells[i]);
+    }
+
+    memset(&header, 0, sizeof(header));
+    strcpy(header.magic, SNAPSHOT_MAGIC);
+    header.version = SNAPSHOT_VERSION;
+    header.cons_size = sizeof(cons);
+    header.short_length = SHORT_LENGTH;
+    header.base = the_memory;
+    header.conses = freep;
+    header.registers = registers_count;
+    header.stack_cells = stack_top;
+    header.symbols = symbol_count;
+    header.primitives = primitive_count;
+    if((out = fopen(path, "wb")) == NULL) {
+        PUT_ERROR("Cannot open snapshot -- save_snapshot", get_nil());
+    }
+    write_snapshot(out, &header, sizeof(header));
+    write_snapshot(out, heap, freep * sizeof(cons));
+    write_snapshot(out, cells, (registers_count + stack_top) * sizeof(cell));
+    for(i = 0; i < symbol_count; i++) {
+        write_snapshot(out, &snapshot_symbols[i]->length, sizeof(size_t));
+        write_snapshot(out, &snapshot_symbols[i]->permanent, sizeof(int));
+        write_snapshot(out, snapshot_symbols[i]->name, snapshot_symbols[i]->length);
+    }
+    if(fclose(out) != 0) {
+        PUT_ERROR("Cannot write snapshot -- save_snapshot", get_nil());
+    }
+    free(snapshot_symbols);
+    free(heap);
+    free(cells);
+}
+
+/*
+ * Reads the names at the end of a snapshot and interns them.  Answers
+ * FALSE when they do not fit in the bytes from next to end.
+ */
+static int load_snapshot_symbols(char *next, char *end, long count) {
+    size_t length;
+    int permanent;
+    long i;
+
+    for(i = 0; i < count; i++) {
+        if((size_t)(end - next) < sizeof(size_t) + sizeof(int)) {
+            return FALSE;
+        }
+        memcpy(&length, next, sizeof(size_t));
+        memcpy(&permanent, next + sizeof(size_t), sizeof(int));
+        next += sizeof(size_t) + sizeof(int);
+        if((size_t)(end - next) < length) {
+            return FALSE;
+        }
+        snapshot_names[i] = intern_symbol(next, length);
+        symbol_entry_of(snapshot_names[i])->permanent |= permanent;
+        next += length;
+    }
+    return next == end;
+}
+
+/*
+ * Replaces the empty heap made by init_memory with a snapshot.  The
+ * registers and primitives must have been set up in the same order as
+ * in the program which saved it.
+ */
+extern void load_snapshot(char *path) {
+    int fd = open(path, O_RDONLY);
+    struct stat status;
+    snapshot_header *header;
+    cell *cells;
+    cell value;
+    char *image;
+    long size;
+    long i;
+
+    if(fd < 0 || fstat(fd, &status) != 0 || status.st_size < (off_t)sizeof(snapshot_header)) {
+        PUT_ERROR("Cannot open snapshot -- load_snapshot", get_nil());
+    }
+    size = status.st_size;
+    image = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(image == MAP_FAILED) {
+        PUT_ERROR("Cannot map snapshot -- load_snapshot", get_nil());
+    }
+    header = (snapshot_header *)image;
+    cells = (cell *)(image + sizeof(snapshot_header) + header->conses * sizeof(cons));
+    if(memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0
+       || header->version != SNAPSHOT_VERSION
+       || header->cons_size != sizeof(cons)
+       || header->short_length != SHORT_LENGTH
+       || header->registers != registers_count
+       || header->primitives != primitive_count
+       || header->conses < 0 || header->stack_cells < 0 || header->symbols < 0
+       || (char *)(cells + header->registers + header->stack_cells) > image + size) {
+        PUT_ERROR("Invalid snapshot -- load_snapshot", get_nil());
+    }
+    snapshot_names = malloc((header->symbols + 1) * sizeof(char *));
+    if(snapshot_names == NULL) {
+        PUT_ERROR("Out of memory -- load_snapshot", get_nil());
+    }
+    if(!load_snapshot_symbols((char *)(cells + header->registers + header->stack_cells), image + size,
+                              header->symbols)) {
+        PUT_ERROR("Invalid snapshot -- load_snapshot", get_nil());
+    }
+    snapshot_base = header->base;
+    ensure_committed(the_space, header->conses);
+    refresh_spaces();
+    memcpy(the_memory, image + sizeof(snapshot_header), header->conses * sizeof(cons));
+    convert_conses(the_memory, header->conses, load_snapshot_cell);
+    freep = header->conses;
+    grow_stack(header->stack_cells);
+    for(i = 0; i < header->registers + header->stack_cells; i++) {
+        if(i < header->registers) {
+            value = cells[i];
+            load_snapshot_cell(&value);
+            relocate_registers[i](value);
+        } else {
+            stack[i - header->registers] = cells[i];
+            load_snapshot_cell(&stack[i - header->registers]);
+        }
+    }
+    stack_top = header->stack_cells;
+    find_markers();
+    free(snapshot_names);
+    munmap(image, size);
+    resize_heap();
+}
+
 extern void init_memory() {
-    stack = get_nil();
+    reserve_space(&memory1, MAX_MEMORY_SIZE * sizeof(cons));
+    reserve_space(&memory2, MAX_MEMORY_SIZE * sizeof(cons));
+    gc_log = getenv("SICP_GC_LOG") != NULL && *getenv("SICP_GC_LOG") != '\0';
+    if(gc_threads == 0) {
+        gc_threads = sysconf(_SC_NPROCESSORS_ONLN);
+        gc_threads = gc_threads < 1 ? 1 : gc_threads > MAX_GC_THREADS ? MAX_GC_THREADS : gc_threads;
+    }
+    if(gc_mode == GC_GENERATIONAL) {
+        reserve_space(&nursery, NURSERY_SIZE * sizeof(cons));
+        commit_space(&nursery, NURSERY_SIZE * sizeof(cons));
+        nursery_memory = (cons *)nursery.base;
+    }
+    freep = 0;
+    resize_heap();
+    stack_top = 0;
 }
 
@@ -8,9 +8,15 @@
  **/
 #define TRUE 1
 #define FALSE 0
-#define SHORT_LENGTH 7
+#define FRAME_VALUES 1
+
+/*
+ * An error is reported and goes to the error handler, which does not
+ * return, or ends the process when no handler is set.
+ */
+#define PUT_ERROR(msg, obj) { put_error(msg, obj); raise_error(10); }
 
-#define PUT_ERROR(msg, obj) { put_error(msg, obj); exit(10); }
+typedef void (*error_handler_type)() __attribute__((noreturn));
 
 enum code {
     POINTER,
@@ -24,14 +30,127 @@ enum code {
     UNDEFINED,
     NONE,
     MOVED,
-    MARKER
+    BUSY,
+    MARKER,
+    VECTOR
+};
+
+enum gc_mode {
+    GC_COPYING,
+    GC_GENERATIONAL,
+    GC_INCREMENTAL,
+    GC_PARALLEL,
+    GC_COMPACT
+};
+
+enum node_kind {
+    LITERAL_NODE,
+    NAME_NODE,
+    APPLICATION_NODE,
+    AND_NODE,
+    OR_NODE,
+    CONDITIONAL_NODE,
+    LAMBDA_NODE,
+    SEQUENCE_NODE,
+    BLOCK_NODE,
+    RETURN_NODE,
+    DECLARATION_NODE,
+    ASSIGNMENT_NODE,
+    OPERATOR_NODE,
+    LOOP_NODE,
+    BREAK_NODE,
+    CONTINUE_NODE,
+    NODE_KINDS
+};
+
+enum operator_code {
+    ADD_OPERATOR,
+    SUBTRACT_OPERATOR,
+    MULTIPLY_OPERATOR,
+    REMAINDER_OPERATOR,
+    EQUAL_OPERATOR,
+    NOT_EQUAL_OPERATOR,
+    LESS_THAN_OPERATOR,
+    LESS_THAN_EQUAL_OPERATOR,
+    MORE_THAN_OPERATOR,
+    MORE_THAN_EQUAL_OPERATOR,
+    NEGATE_OPERATOR,
+    NOT_OPERATOR,
+    OPERATORS
+};
+
+enum vector_kind {
+    FRAME_VECTOR = NODE_KINDS,
+    GLOBAL_VECTOR,
+    TABLE_VECTOR,
+    STACK_VECTOR,
+    STRING_VECTOR,
+    ROPE_VECTOR
 };
 
 struct cons_tag;
-struct cell_tag;
+struct primitive_tag;
 
 typedef void (*cont_type)();
 
+/*
+ * Cells are only accessed through the CELL_ macros below, so that the
+ * representation can be chosen at build time.  The default is a tagged
+ * struct of 16 bytes.  With -DNAN_BOXING a cell is one 8 byte word: a
+ * double is stored as itself, and every other value is a negative quiet
+ * NaN whose top 16 bits hold the tag and whose low 48 bits hold a
+ * pointer, a vector header or the characters of a short symbol.  NaN
+ * numbers are canonicalized to a positive NaN so they never look boxed.
+ * NaN boxing assumes a little-endian machine with 48-bit user addresses.
+ */
+#ifdef NAN_BOXING
+
+#define SHORT_LENGTH 5
+#define NAN_TAG_BASE 0xFFF1UL
+#define NAN_TAG_SHIFT 48
+#define NAN_PAYLOAD_MASK ((1UL << NAN_TAG_SHIFT) - 1)
+#define NAN_CANONICAL 0x7FF8000000000000UL
+#define NAN_TAG(type) ((NAN_TAG_BASE + (type)) << NAN_TAG_SHIFT)
+
+typedef union cell_tag {
+    unsigned long bits;
+    double number;
+} cell;
+
+typedef unsigned long cell_tag_word;
+
+#define CELL_INITIALIZER(type) { NAN_TAG(type) }
+#define CELL_TAG_WORD(c) ((c).bits)
+#define TAG_WORD_TYPE(word) \
+    ((word) >= NAN_TAG(0) ? (enum code)(((word) >> NAN_TAG_SHIFT) - NAN_TAG_BASE) : NUMBER)
+#define TYPE_TAG_WORD(type) NAN_TAG(type)
+#define CELL_TYPE(c) TAG_WORD_TYPE((c).bits)
+#define CELL_PAYLOAD(c) ((c).bits & NAN_PAYLOAD_MASK)
+#define CELL_POINTER(c) ((struct cons_tag *)CELL_PAYLOAD(c))
+#define CELL_NUMBER(c) ((c).number)
+#define CELL_SYMBOL(c) ((char *)CELL_PAYLOAD(c))
+#define CELL_SHORT_SYMBOL(c) ((char *)&(c).bits)
+#define CELL_PRIMITIVE(c) ((struct primitive_tag *)CELL_PAYLOAD(c))
+#define CELL_CONTINUATION(c) ((cont_type)CELL_PAYLOAD(c))
+#define CELL_MARKER_SERIAL(c) ((long)CELL_PAYLOAD(c))
+#define CELL_VECTOR_LENGTH(c) ((int)((c).bits & 0xFFFFFFFFUL))
+#define CELL_VECTOR_KIND(c) ((int)(CELL_PAYLOAD(c) >> 32))
+
+#define CELL_SET_TYPE(c, type) { (c).bits = NAN_TAG(type); }
+#define CELL_SET_BOXED(c, type, payload) { (c).bits = NAN_TAG(type) | ((unsigned long)(payload) & NAN_PAYLOAD_MASK); }
+#define CELL_SET_POINTER(c, p) CELL_SET_BOXED(c, POINTER, p)
+#define CELL_SET_NUMBER(c, n) { (c).number = (n); if((c).number != (c).number) (c).bits = NAN_CANONICAL; }
+#define CELL_SET_SYMBOL(c, s) CELL_SET_BOXED(c, SYMBOL, s)
+#define CELL_SET_PRIMITIVE(c, f) CELL_SET_BOXED(c, PRIMITIVE, f)
+#define CELL_SET_CONTINUATION(c, k) CELL_SET_BOXED(c, CONTINUATION, k)
+#define CELL_SET_MARKER(c, n) CELL_SET_BOXED(c, MARKER, n)
+#define CELL_SET_VECTOR_HEADER(c, length, kind) \
+    CELL_SET_BOXED(c, VECTOR, ((unsigned long)(kind) << 32) | (unsigned int)(length))
+
+#else
+
+#define SHORT_LENGTH 7
+
 typedef struct cell_tag {
     enum code type;
     union cell_inner_tag {
@@ -39,16 +158,76 @@ typedef struct cell_tag {
         double number;
         char *symbol;
         char short_symbol[SHORT_LENGTH + 1];
-        struct cell_tag (*primitive)(struct cell_tag);
+        struct vector_header_tag {
+            int length;
+            int kind;
+        } header;
+        struct primitive_tag *primitive;
         cont_type cont;
+        long serial;
     } datum;
 } cell;
 
+typedef enum code cell_tag_word;
+
+#define CELL_INITIALIZER(type) { type, { NULL } }
+#define CELL_TAG_WORD(c) ((c).type)
+#define TAG_WORD_TYPE(word) (word)
+#define TYPE_TAG_WORD(type) (type)
+#define CELL_TYPE(c) ((c).type)
+#define CELL_POINTER(c) ((c).datum.ptr)
+#define CELL_NUMBER(c) ((c).datum.number)
+#define CELL_SYMBOL(c) ((c).datum.symbol)
+#define CELL_SHORT_SYMBOL(c) ((c).datum.short_symbol)
+#define CELL_PRIMITIVE(c) ((c).datum.primitive)
+#define CELL_CONTINUATION(c) ((c).datum.cont)
+#define CELL_MARKER_SERIAL(c) ((c).datum.serial)
+#define CELL_VECTOR_LENGTH(c) ((c).datum.header.length)
+#define CELL_VECTOR_KIND(c) ((c).datum.header.kind)
+
+#define CELL_SET_TYPE(c, t) { (c).type = (t); }
+#define CELL_SET_POINTER(c, p) { (c).type = POINTER; (c).datum.ptr = (p); }
+#define CELL_SET_NUMBER(c, n) { (c).type = NUMBER; (c).datum.number = (n); }
+#define CELL_SET_SYMBOL(c, s) { (c).type = SYMBOL; (c).datum.symbol = (s); }
+#define CELL_SET_PRIMITIVE(c, f) { (c).type = PRIMITIVE; (c).datum.primitive = (f); }
+#define CELL_SET_CONTINUATION(c, k) { (c).type = CONTINUATION; (c).datum.cont = (k); }
+#define CELL_SET_MARKER(c, n) { (c).type = MARKER; (c).datum.serial = (n); }
+#define CELL_SET_VECTOR_HEADER(c, l, k) \
+    { (c).type = VECTOR; (c).datum.header.length = (l); (c).datum.header.kind = (k); }
+
+#endif
+
 typedef struct cons_tag {
     cell head_cell;
     cell tail_cell;
 } cons;
 
+/*
+ * A primitive takes its arguments as an array, which points into the
+ * control stack, and requires at least arity of them.  A primitive
+ * written to take a list has list_function set and is called through
+ * an adapter which conses the arguments up.
+ */
+typedef cell (*array_primitive_type)(int argc, cell *argv);
+typedef cell (*list_primitive_type)(cell args);
+
+typedef struct primitive_tag {
+    array_primitive_type function;
+    list_primitive_type list_function;
+    int arity;
+} primitive_entry;
+
+/*
+ * A borrowed view of the characters of a symbol or string.  For a short
+ * symbol it points into the cell passed to get_symbol_view, so it is
+ * only valid as long as that cell variable is, and never across a
+ * collection.  The characters are always followed by a NUL.
+ */
+typedef struct symbol_view_tag {
+    char *chars;
+    long length;
+} symbol_view;
+
 typedef cell (*push_register)();
 typedef void (*relocate_register)(cell);
 
@@ -61,6 +240,10 @@ extern cell get_pointer(cons *ptr);
 extern cell get_nil();
 extern cell get_symbol(char *, int);
 extern cell get_symbol_len(char *);
+extern cell get_permanent_symbol(char *);
+extern cell get_string(char *src, int len);
+extern int is_string(cell);
+extern int eq_symbol(cell c1, cell c2);
 extern int equal_symbol(cell c, char *sym);
 extern cell compare(cell left, cell right, int (*compare_type)(int));
 extern cell get_true();
@@ -70,7 +253,8 @@ extern cell get_undefined();
 extern cell get_number(double number);
 extern cell get_continuation(cont_type);
 extern cell get_none();
-extern cell get_primitive(cell (*primitive)(cell));
+extern cell get_primitive(list_primitive_type function);
+extern cell get_array_primitive(array_primitive_type function, int arity);
 extern int is_null(cell);
 extern int is_pair(cell);
 extern int is_none(cell);
@@ -78,23 +262,43 @@ extern int is_primitive_function(cell);
 extern int is_falsy(cell);
 extern int is_truthy(cell);
 extern cell pair(cell, cell);
+extern cell make_vector(int kind, int length);
+extern int is_vector(cell);
+extern int vector_kind(cell);
+extern int vector_length(cell);
+extern cell vector_ref(cell, int);
+extern void vector_set(cell, int, cell);
 extern cell head(cell);
 extern cell tail(cell);
 extern cell set_head(cell, cell);
 extern cell set_tail(cell, cell);
-extern cell lookup_variable_value(char *sym, cons *env);
-extern void assign_symbol_value(char *sym, cell val, cons *env);
+extern cell lookup_global_binding(cell sym, cons *env);
+extern void define_global_value(cell sym, cell val, cons *env);
+extern cons *make_global_environment(cell names, cell values);
+extern cons *global_environment(cons *env);
+extern cell lookup_lexical_value(int depth, int index, cons *env);
+extern void assign_lexical_value(int depth, int index, cell val, cons *env);
 extern cons *extend_environment(cell unev, cell argl, cons *env);
+extern cons *extend_environment_arguments(cell unev, int argc, cell *argv, cons *env);
 extern void save(cell);
 extern void save_cons(cons *);
 extern void save_continuation(cont_type);
 extern cell restore();
+extern cell *stack_arguments(int count);
+extern void drop_stack(int count);
 extern cons *restore_cons();
 extern cont_type restore_continuation();
 extern void push_marker_to_stack();
 extern void revert_stack_to_marker();
-extern cell apply_primitive_function(cell fun, cell argl);
+extern void drop_stack_to_marker();
+extern long innermost_frame();
+extern long frame_serial(long frame);
+extern int revert_stack_to_frame(long frame, long serial);
+extern void reset_stack();
+extern cell apply_primitive_function(cell fun, int argc, cell *argv);
+extern int is_operator_primitive(cell fun, enum operator_code op);
 extern cons *setup_environment();
+extern void init_primitives();
 extern cell append(cell, cell);
 extern cell parse(char *prog);
 extern cell make_literal(cell value);
@@ -111,9 +315,13 @@ extern cell make_function_declaration(cell name, cell names, cell block);
 extern cell make_conditional(char *tp, cell predicate, cell consequent, cell alternative);
 extern cell make_return_statement(cell expression);
 extern cell make_assignment(cell name, cell expression);
+extern cell make_while_loop(cell predicate, cell body);
+extern cell make_for_loop(cell initializer, cell predicate, cell update, cell body);
+extern cell make_break_statement();
+extern cell make_continue_statement();
 extern cell evaluate(cell prog, cons *env);
-extern cons *create_environment(cell program, cons *environment);
-extern char *check_and_get_symbol(cell c);
+extern void create_environment(cell program, cons *environment);
+extern symbol_view get_symbol_view(cell *c);
 extern double check_and_get_number(cell c);
 extern int check_and_get_int(cell c);
 extern cons *check_and_get_cons_ptr(cell c);
@@ -129,9 +337,28 @@ extern int is_numeric(cell s);
 extern int eqv(cell c1, cell c2);
 extern void display(cell to_display);
 extern cell execute(char *program);
+extern void reset_machine();
+extern cell program_declarations(cell program);
+extern cell analyze_program(cell program);
+extern void compile_program(char *program, FILE *out);
+extern void define_unassigned(cell symbols, cons *environment);
+extern cell call_cc_program();
+extern void revert_stack_to_escape(cell escape);
+extern void init_vm();
+extern cell execute_vm(char *program);
+extern void set_vm_cache(char *directory);
 extern void init_cons();
+extern void init_cons_from_snapshot(char *path);
 extern void display_memory_usage();
+extern cell gc_stats();
 extern void put_error(char *msg, cell obj);
+extern void set_error_handler(error_handler_type handler);
+extern void raise_error(int status) __attribute__((noreturn));
+extern void set_gc_mode(enum gc_mode mode);
+extern void set_gc_threads(int threads);
+extern int set_gc_option(char *option);
 extern void init_memory();
+extern void save_snapshot(char *path);
+extern void load_snapshot(char *path);
 extern cell parse_js_bison(char *program);
 
@@ -230,7 +230,7 @@ static cell parse_primitive() {
     } else {
         for(now = parsers; *now != NULL; now++) {
             result = (*now)(current);
-            if(result.type != NONE) {
+            if(CELL_TYPE(result) != NONE) {
                 return result;
             }
         }
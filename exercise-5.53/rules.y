@@ -6,14 +6,14 @@
  * This software is released under the MIT License.
  * http://opensource.org/licenses/mit-license.php
  **/
-%token RETURN CONST LET FUNCTION IF ELSE
+%token RETURN CONST LET FUNCTION IF ELSE WHILE FOR BREAK CONTINUE
 %token NULL_WORD TRUE_WORD FALSE_WORD ARROW START_ARROW
 %token <num> NUMBER_WORD
 %token <str> STRING_LITERAL
 %token <datum> NAME NAME_ARROW
 
 %type <datum> sequence sequence_list statement conditional_statement return_statement constant_declaration variable_declaration
-%type <datum> function_declaration block names name_list
+%type <datum> function_declaration block names name_list while_loop for_loop for_initializer
 %type <datum> expression expression_op function_expression element expressions expression_list lambda_expression
 
 %left OR
@@ -59,12 +59,24 @@ statement : expression ';'          { $$ = $1; }
           | constant_declaration
           | variable_declaration
           | function_declaration
+          | while_loop
+          | for_loop
+          | BREAK ';'               { $$ = make_break_statement(); }
+          | CONTINUE ';'            { $$ = make_continue_statement(); }
 
 conditional_statement : IF '(' expression ')' block ELSE block
                         { $$ = make_conditional("conditional_statement", $3, $5, $7); }
                       | IF '(' expression ')' block ELSE conditional_statement
                         { $$ = make_conditional("conditional_statement", $3, $5, $7); }
 
+while_loop : WHILE '(' expression ')' block { $$ = make_while_loop($3, $5); }
+
+for_loop : FOR '(' for_initializer ';' expression ';' NAME '=' expression ')' block
+           { $$ = make_for_loop($3, $5, make_assignment($7, $9), $11); }
+
+for_initializer : LET NAME '=' expression { $$ = make_variable_declaration($2, $4); }
+                | NAME '=' expression     { $$ = make_assignment($1, $3); }
+
 return_statement : RETURN expression ';' { $$ = make_return_statement($2); }
 
 constant_declaration : CONST NAME '=' expression ';' { $$ = make_constant_declaration($2, $4); }
@@ -108,7 +120,7 @@ function_expression : function_expression '(' expressions ')' { $$ = make_applic
 
 element : '(' expression ')' { $$ = $2; }
         | NUMBER_WORD    { $$ = make_literal(get_number($1)); }
-        | STRING_LITERAL { $$ = make_literal(get_symbol_len($1)); }
+        | STRING_LITERAL { $$ = make_literal(get_string($1, strlen($1))); }
         | NULL_WORD      { $$ = make_literal(get_nil()); }
         | TRUE_WORD      { $$ = make_literal(get_true()); }
         | FALSE_WORD     { $$ = make_literal(get_false()); }
@@ -131,6 +143,12 @@ lambda_expression : START_ARROW names ')' ARROW block { $$ = make_lambda_express
 #define NOT_MATCHED 0
 #define ARENA_SIZE 200000
 
+/*
+ * An error of the lexer goes to the error handler as the errors of the
+ * evaluator do, so that a server can go on with its next request.
+ */
+#define LEXER_ERROR(msg) { perror(msg); raise_error(4); }
+
 static char arena_base[ARENA_SIZE + 1];
 static char *arena_ptr = arena_base;
 
@@ -216,11 +234,10 @@ static int lex_string_1(char *cur, char ch) {
 
 static int lex_string_2(char *cur, char ch) {
   if(*cur == '\0') {
-    perror("Invalid string");
-    exit(4);
+    LEXER_ERROR("Invalid string");
   } else if(*cur == ch) {
-    yylval.str = newstr_arena(current, cur - current);
-    current = cur;
+    yylval.str = newstr_arena(current + 1, cur - current - 1);
+    current = cur + 1;
     return STRING_LITERAL;
   } else if(*cur == '\\') {
     return lex_string_3(cur + 1, ch);
@@ -231,8 +248,7 @@ static int lex_string_2(char *cur, char ch) {
 
 static int lex_string_3(char *cur, char ch) {
   if(*cur == '\0') {
-    perror("Invalid string");
-    exit(4);
+    LEXER_ERROR("Invalid string");
   } else {
     return lex_string_2(cur + 1, ch);
   }
@@ -273,8 +289,7 @@ static int lex_number_1(char *cur, int first) {
       current = cur;
       return NUMBER_WORD;
     } else {
-      perror("Internal Error");
-      exit(4);
+      LEXER_ERROR("Internal Error");
     }
   } else {
     if(first == NUM) {
@@ -291,8 +306,7 @@ static int lex_number_2(char *cur) {
   if(isdigit(*cur)) {
     return lex_number_3(cur + 1);
   } else {
-    perror("Invalid number");
-    exit(4);
+    LEXER_ERROR("Invalid number");
   }
 }
 
@@ -312,8 +326,7 @@ static int lex_number_4(char *cur) {
   if(isdigit(*cur)) {
     return lex_number_5(cur + 1);
   } else {
-    perror("Invalid number");
-    exit(4);
+    LEXER_ERROR("Invalid number");
   }
 }
 
@@ -407,6 +420,10 @@ static int lex_return(char *cur) { return start_with_word(cur, "return", RETURN)
 static int lex_const(char *cur) { return start_with_word(cur, "const", CONST); }
 static int lex_let(char *cur) { return start_with_word(cur, "let", LET); }
 static int lex_function(char *cur) { return start_with_word(cur, "function", FUNCTION); }
+static int lex_while(char *cur) { return start_with_word(cur, "while", WHILE); }
+static int lex_for(char *cur) { return start_with_word(cur, "for", FOR); }
+static int lex_break(char *cur) { return start_with_word(cur, "break", BREAK); }
+static int lex_continue(char *cur) { return start_with_word(cur, "continue", CONTINUE); }
 static int lex_null(char *cur) { return start_with_word(cur, "null", NULL_WORD); }
 static int lex_true(char *cur) { return start_with_word(cur, "true", TRUE_WORD); }
 static int lex_false(char *cur) { return start_with_word(cur, "false", FALSE_WORD); }
@@ -444,10 +461,14 @@ static lexer lexers[] = {
   lex_const,
   lex_let,
   lex_function,
+  lex_while,
+  lex_for,
+  lex_break,
+  lex_continue,        // 20
   lex_null,
   lex_true,
   lex_false,
-  lex_symbol_1,        // 20
+  lex_symbol_1,
   lex_number,
   lex_ch,
   NULL
@@ -471,13 +492,13 @@ int yylex(void) {
         return result;
       }
     }
-    perror("Lexer error");
-    exit(4);
+    LEXER_ERROR("Lexer error");
   }
 }
 
 extern cell parse_js_bison(char *program) {
   final_result = get_nil();
+  arena_ptr = arena_base;
   init_parser(program);
   yyparse();
   return final_result;
@@ -60,83 +60,78 @@ static cell append_args(cell args) {
     return append(head(args), head(tail(args)));
 }
 
-static cell negate(cell args) {
-    cell right = head(args);
+static cell negate(int argc, cell *argv) {
+    cell right = argv[0];
     cell result;
 
-    if(right.type == NUMBER) {
-        result.type = NUMBER;
-        result.datum.number = -right.datum.number;
+    if(CELL_TYPE(right) == NUMBER) {
+        CELL_SET_NUMBER(result, -CELL_NUMBER(right));
         return result;
     } else {
         PUT_ERROR("Invalid argument -- negate", get_nil());
     }
 }
 
-static cell add(cell args) {
-    cell left = head(args);
-    cell right = head(tail(args));
+static cell add(int argc, cell *argv) {
+    cell left = argv[0];
+    cell right = argv[1];
     cell result;
 
-    if(left.type != right.type) {
-        printf("%d %d\n", left.type, right.type);
-        if(right.type == NUMBER) {
-            printf("%lf\n", right.datum.number);
+    if(CELL_TYPE(left) != CELL_TYPE(right)) {
+        printf("%d %d\n", CELL_TYPE(left), CELL_TYPE(right));
+        if(CELL_TYPE(right) == NUMBER) {
+            printf("%lf\n", CELL_NUMBER(right));
         }
         PUT_ERROR("Invalid argument -- add", get_nil());
-    } else if(left.type == NUMBER) {
-        result.type = NUMBER;
-        result.datum.number = left.datum.number + right.datum.number;
+    } else if(CELL_TYPE(left) == NUMBER) {
+        CELL_SET_NUMBER(result, CELL_NUMBER(left) + CELL_NUMBER(right));
         return result;
-    } else if(left.type == SYMBOL) {
+    } else if(CELL_TYPE(left) == SYMBOL) {
         PUT_ERROR("Not implemented -- add", get_nil());
     } else {
         PUT_ERROR("Invalid argument -- add", get_nil());
     }
 }
 
-static cell subtract(cell args) {
-    cell left = head(args);
-    cell right = head(tail(args));
+static cell subtract(int argc, cell *argv) {
+    cell left = argv[0];
+    cell right = argv[1];
     cell result;
 
-    if(left.type != right.type) {
+    if(CELL_TYPE(left) != CELL_TYPE(right)) {
         PUT_ERROR("Invalid argument -- subtract", get_nil());
-    } else if(left.type == NUMBER) {
-        result.type = NUMBER;
-        result.datum.number = left.datum.number - right.datum.number;
+    } else if(CELL_TYPE(left) == NUMBER) {
+        CELL_SET_NUMBER(result, CELL_NUMBER(left) - CELL_NUMBER(right));
         return result;
     } else {
         PUT_ERROR("Invalid argument -- subtract", get_nil());
     }
 }
 
-static cell multiply(cell args) {
-    cell left = head(args);
-    cell right = head(tail(args));
+static cell multiply(int argc, cell *argv) {
+    cell left = argv[0];
+    cell right = argv[1];
     cell result;
 
-    if(left.type != right.type) {
+    if(CELL_TYPE(left) != CELL_TYPE(right)) {
         PUT_ERROR("Invalid argument -- multiply", get_nil());
-    } else if(left.type == NUMBER) {
-        result.type = NUMBER;
-        result.datum.number = left.datum.number * right.datum.number;
+    } else if(CELL_TYPE(left) == NUMBER) {
+        CELL_SET_NUMBER(result, CELL_NUMBER(left) * CELL_NUMBER(right));
         return result;
     } else {
         PUT_ERROR("Invalid argument -- multiply", get_nil());
     }
 }
 
-static cell remainder_cell(cell args) {
-    cell left = head(args);
-    cell right = head(tail(args));
+static cell remainder_cell(int argc, cell *argv) {
+    cell left = argv[0];
+    cell right = argv[1];
     cell result;
 
-    if(left.type != right.type) {
+    if(CELL_TYPE(left) != CELL_TYPE(right)) {
         PUT_ERROR("Invalid argument -- remainder", get_nil());
-    } else if(left.type == NUMBER) {
-        result.type = NUMBER;
-        result.datum.number = fmod(left.datum.number, right.datum.number);
+    } else if(CELL_TYPE(left) == NUMBER) {
+        CELL_SET_NUMBER(result, fmod(CELL_NUMBER(left), CELL_NUMBER(right)));
         return result;
     } else {
         PUT_ERROR("Invalid argument -- remainder", get_nil());
@@ -159,60 +154,56 @@ static int more_than_equal(int type) {
     return type >= 0;
 }
 
-static cell compare_less_than(cell args) {
-    return compare(head(args), head(tail(args)), less_than);
+static cell compare_less_than(int argc, cell *argv) {
+    return compare(argv[0], argv[1], less_than);
 }
 
-static cell compare_less_than_equal(cell args) {
-    return compare(head(args), head(tail(args)), less_than_equal);
+static cell compare_less_than_equal(int argc, cell *argv) {
+    return compare(argv[0], argv[1], less_than_equal);
 }
 
-static cell compare_more_than(cell args) {
-    return compare(head(args), head(tail(args)), more_than);
+static cell compare_more_than(int argc, cell *argv) {
+    return compare(argv[0], argv[1], more_than);
 }
 
-static cell compare_more_than_equal(cell args) {
-    return compare(head(args), head(tail(args)), more_than_equal);
+static cell compare_more_than_equal(int argc, cell *argv) {
+    return compare(argv[0], argv[1], more_than_equal);
 }
 
-static cell logical_not(cell args) {
-    return is_falsy(head(args)) ? get_true() : get_false();
+static cell logical_not(int argc, cell *argv) {
+    return is_falsy(argv[0]) ? get_true() : get_false();
 }
 
-static cell eqv_cell(cell args) {
-    cell r = get_number(eqv(head(args), head(tail(args))));
-
-    return r;
+static cell eqv_cell(int argc, cell *argv) {
+    return get_number(eqv(argv[0], argv[1]));
 }
 
-static cell not_eqv_cell(cell args) {
-    return get_number(!eqv(head(args), head(tail(args))));
+static cell not_eqv_cell(int argc, cell *argv) {
+    return get_number(!eqv(argv[0], argv[1]));
 }
 
-static cell pair_cell(cell args) {
-    return pair(head(args), head(tail(args)));
+static cell pair_cell(int argc, cell *argv) {
+    return pair(argv[0], argv[1]);
 }
 
-static cell head_cell(cell args) {
-    return head(head(args));
+static cell head_cell(int argc, cell *argv) {
+    return head(argv[0]);
 }
 
-static cell tail_cell(cell args) {
-    return tail(head(args));
+static cell tail_cell(int argc, cell *argv) {
+    return tail(argv[0]);
 }
 
-static cell is_null_cell(cell args) {
-    cell test = head(args);
-
-    return is_null(test) ? get_true() : get_false();
+static cell is_null_cell(int argc, cell *argv) {
+    return is_null(argv[0]) ? get_true() : get_false();
 }
 
-static cell set_head_cell(cell args) {
-    return set_head(head(args), head(tail(args)));
+static cell set_head_cell(int argc, cell *argv) {
+    return set_head(argv[0], argv[1]);
 }
 
-static cell set_tail_cell(cell args) {
-    return set_tail(head(args), head(tail(args)));
+static cell set_tail_cell(int argc, cell *argv) {
+    return set_tail(argv[0], argv[1]);
 }
 
 static cell array_to_list(cell *ptr) {
@@ -223,64 +214,100 @@ static cell array_to_list(cell *ptr) {
     }
 }
 
-extern cell string_ref_cell(cell args) {
-    return string_ref(head(args), check_and_get_int(head(tail(args))));
+extern cell string_ref_cell(int argc, cell *argv) {
+    return string_ref(argv[0], check_and_get_int(argv[1]));
 }
 
-extern cell string_length_cell(cell args) {
-    cell r = string_length(head(args));
-
-    return r;
+extern cell string_length_cell(int argc, cell *argv) {
+    return string_length(argv[0]);
 }
 
-extern cell string_append_cell(cell args) {
-    return string_append(head(args), head(tail(args)));
+extern cell string_append_cell(int argc, cell *argv) {
+    return string_append(argv[0], argv[1]);
 }
 
-extern cell substring_cell(cell args) {
-    int begin = check_and_get_int(head(tail(args)));
-    int end = check_and_get_int(head(tail(tail(args))));
-    cell r = substring(head(args), begin, end);
-
-    return r;
+extern cell substring_cell(int argc, cell *argv) {
+    return substring(argv[0], check_and_get_int(argv[1]), check_and_get_int(argv[2]));
 }
 
-extern cell char_to_integer_cell(cell args) {
-    return get_number(char_to_integer(head(args)));
+extern cell char_to_integer_cell(int argc, cell *argv) {
+    return get_number(char_to_integer(argv[0]));
 }
 
-extern cell is_whitespace_cell(cell args) {
-    return is_whitespace(head(args)) ? get_true() : get_false();
+extern cell is_whitespace_cell(int argc, cell *argv) {
+    return is_whitespace(argv[0]) ? get_true() : get_false();
 }
 
-extern cell is_alphabetic_cell(cell args) {
-    return is_alphabetic(head(args)) ? get_true() : get_false();
+extern cell is_alphabetic_cell(int argc, cell *argv) {
+    return is_alphabetic(argv[0]) ? get_true() : get_false();
 }
 
-extern cell is_numeric_cell(cell args) {
-    return is_numeric(head(args)) ? get_true() : get_false();
+extern cell is_numeric_cell(int argc, cell *argv) {
+    return is_numeric(argv[0]) ? get_true() : get_false();
 }
 
-static cell display_cell(cell args) {
-    display(head(args));
+static cell display_cell(int argc, cell *argv) {
+    display(argv[0]);
     return get_undefined();
 }
 
-static cell getcont_cell(cell args) {
+static cell getcont_cell(int argc, cell *argv) {
     cons *cont = save_registers();
 
     return pair(get_symbol_len("%cont"), pair(get_pointer(cont), get_nil()));
 }
 
+/*
+ * An escape continuation only names the frame it was made in, which
+ * is the frame of call_ec as a primitive pushes none.
+ */
+static cell getesc_cell(int argc, cell *argv) {
+    long frame = innermost_frame();
+
+    return pair(get_symbol_len("%esc"),
+                pair(get_number(frame), pair(get_number(frame_serial(frame)), get_nil())));
+}
+
 static cell error_cell(cell error) {
     PUT_ERROR("Error", head(error));
 }
 
-static cell display_memory_usage_cell(cell args) {
+static cell display_memory_usage_cell(int argc, cell *argv) {
     display_memory_usage();
     return get_undefined();
 }
 
+static cell gc_stats_cell(int argc, cell *argv) {
+    return gc_stats();
+}
+
+/*
+ * The primitives the evaluator may compute inline, indexed by
+ * enum operator_code.
+ */
+static array_primitive_type operator_primitives[OPERATORS] = {
+    add,
+    subtract,
+    multiply,
+    remainder_cell,
+    eqv_cell,
+    not_eqv_cell,
+    compare_less_than,
+    compare_less_than_equal,
+    compare_more_than,
+    compare_more_than_equal,
+    negate,
+    logical_not
+};
+
+extern int is_operator_primitive(cell fun, enum operator_code op) {
+    return is_primitive_function(fun) && CELL_PRIMITIVE(fun)->function == operator_primitives[op];
+}
+
+extern cell apply_operator(enum operator_code op, int argc, cell *argv) {
+    return operator_primitives[op](argc, argv);
+}
+
 static cell *init_symbol_list() {
     static cell symbol_list[1000];
     cell *ptr = symbol_list;
@@ -317,9 +344,11 @@ static cell *init_symbol_list() {
     *ptr++ = get_symbol_len("unary-");
     *ptr++ = get_symbol_len("%");
     *ptr++ = get_symbol_len("%getcont");
+    *ptr++ = get_symbol_len("%getesc");
     *ptr++ = get_symbol_len("error");
     *ptr++ = get_symbol_len("display");
     *ptr++ = get_symbol_len("display_memory_usage");
+    *ptr++ = get_symbol_len("gc_stats");
     *ptr++ = get_nil();
     return symbol_list;
 }
@@ -328,49 +357,58 @@ static cell *init_primitive_list() {
     static cell primitive_list[1000];
     cell *ptr = primitive_list;
 
-    *ptr++ = get_primitive(pair_cell);
-    *ptr++ = get_primitive(head_cell);
-    *ptr++ = get_primitive(tail_cell);
-    *ptr++ = get_primitive(is_null_cell);
+    *ptr++ = get_array_primitive(pair_cell, 2);
+    *ptr++ = get_array_primitive(head_cell, 1);
+    *ptr++ = get_array_primitive(tail_cell, 1);
+    *ptr++ = get_array_primitive(is_null_cell, 1);
     *ptr++ = get_primitive(list);
     *ptr++ = get_primitive(append_args);
     *ptr++ = get_primitive(reverse);
     *ptr++ = get_primitive(memv);
     *ptr++ = get_primitive(assv);
-    *ptr++ = get_primitive(set_head_cell);
-    *ptr++ = get_primitive(set_tail_cell);
-    *ptr++ = get_primitive(string_ref_cell);
-    *ptr++ = get_primitive(string_length_cell);
-    *ptr++ = get_primitive(string_append_cell);
-    *ptr++ = get_primitive(substring_cell);
-    *ptr++ = get_primitive(char_to_integer_cell);
-    *ptr++ = get_primitive(is_whitespace_cell);
-    *ptr++ = get_primitive(is_alphabetic_cell);
-    *ptr++ = get_primitive(is_numeric_cell);
-    *ptr++ = get_primitive(eqv_cell);
-    *ptr++ = get_primitive(not_eqv_cell);
-    *ptr++ = get_primitive(compare_less_than);
-    *ptr++ = get_primitive(compare_less_than_equal);
-    *ptr++ = get_primitive(compare_more_than);
-    *ptr++ = get_primitive(compare_more_than_equal);
-    *ptr++ = get_primitive(logical_not);
-    *ptr++ = get_primitive(add);
-    *ptr++ = get_primitive(subtract);
-    *ptr++ = get_primitive(multiply);
-    *ptr++ = get_primitive(negate);
-    *ptr++ = get_primitive(remainder_cell);
-    *ptr++ = get_primitive(getcont_cell);
+    *ptr++ = get_array_primitive(set_head_cell, 2);
+    *ptr++ = get_array_primitive(set_tail_cell, 2);
+    *ptr++ = get_array_primitive(string_ref_cell, 2);
+    *ptr++ = get_array_primitive(string_length_cell, 1);
+    *ptr++ = get_array_primitive(string_append_cell, 2);
+    *ptr++ = get_array_primitive(substring_cell, 3);
+    *ptr++ = get_array_primitive(char_to_integer_cell, 1);
+    *ptr++ = get_array_primitive(is_whitespace_cell, 1);
+    *ptr++ = get_array_primitive(is_alphabetic_cell, 1);
+    *ptr++ = get_array_primitive(is_numeric_cell, 1);
+    *ptr++ = get_array_primitive(eqv_cell, 2);
+    *ptr++ = get_array_primitive(not_eqv_cell, 2);
+    *ptr++ = get_array_primitive(compare_less_than, 2);
+    *ptr++ = get_array_primitive(compare_less_than_equal, 2);
+    *ptr++ = get_array_primitive(compare_more_than, 2);
+    *ptr++ = get_array_primitive(compare_more_than_equal, 2);
+    *ptr++ = get_array_primitive(logical_not, 1);
+    *ptr++ = get_array_primitive(add, 2);
+    *ptr++ = get_array_primitive(subtract, 2);
+    *ptr++ = get_array_primitive(multiply, 2);
+    *ptr++ = get_array_primitive(negate, 1);
+    *ptr++ = get_array_primitive(remainder_cell, 2);
+    *ptr++ = get_array_primitive(getcont_cell, 0);
+    *ptr++ = get_array_primitive(getesc_cell, 0);
     *ptr++ = get_primitive(error_cell);
-    *ptr++ = get_primitive(display_cell);
-    *ptr++ = get_primitive(display_memory_usage_cell);
+    *ptr++ = get_array_primitive(display_cell, 1);
+    *ptr++ = get_array_primitive(display_memory_usage_cell, 0);
+    *ptr++ = get_array_primitive(gc_stats_cell, 0);
     *ptr++ = get_nil();
     return primitive_list;
 }
 
+/*
+ * Creates the primitives as setup_environment does, for a global
+ * environment loaded from a snapshot.
+ */
+extern void init_primitives() {
+    init_primitive_list();
+}
+
 extern cons *setup_environment() {
-    return extend_environment(
+    return make_global_environment(
             array_to_list(init_symbol_list()),
-            array_to_list(init_primitive_list()),
-            NULL);
+            array_to_list(init_primitive_list()));
 }
 
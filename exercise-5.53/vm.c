@@ -0,0 +1,1285 @@
+/*
+ * Solution of SICP JS Exercise 5.53
+ *
+ * Copyright (c) 2025 Yuichiro MORIGUCHI
+ *
+ * This software is released under the MIT License.
+ * http://opensource.org/licenses/mit-license.php
+ **/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "memory.h"
+#include "compiled.h"
+
+/*
+ * A bytecode engine selected by --vm.  The nodes analyzed by engine.c are
+ * compiled into one code array and run by a single loop, which threads
+ * through the instructions with computed gotos where GCC allows them and
+ * with a switch otherwise.  It shares the registers and the stack of the
+ * machine in engine.c, so %getcont captures it the same way.
+ *
+ * A call leaves the caller's environment, the offset of its return
+ * address and a marker on the stack, and a return reverts to the marker
+ * and pops the other two.  A call in a return expression drops what is
+ * above the marker and enters the callee in the same frame, so tail
+ * calls do not grow the stack.
+ *
+ * The garbage collector only runs after an instruction which allocates
+ * or jumps back in a loop, when every live cell is in a register or on
+ * the stack.
+ */
+#if defined(__GNUC__) && !defined(VM_SWITCH_DISPATCH)
+#define VM_THREADED
+#endif
+
+enum vm_opcode {
+    CONSTANT_INSTRUCTION,
+    NUMBER_INSTRUCTION,
+    LOCAL_INSTRUCTION,
+    GLOBAL_INSTRUCTION,
+    PUSH_INSTRUCTION,
+    PUSH_CONSTANT_INSTRUCTION,
+    PUSH_NUMBER_INSTRUCTION,
+    PUSH_LOCAL_INSTRUCTION,
+    PUSH_GLOBAL_INSTRUCTION,
+    SET_LOCAL_INSTRUCTION,
+    SET_GLOBAL_INSTRUCTION,
+    OPERATOR_INSTRUCTION,
+    OPERATOR_NUMBER_INSTRUCTION,
+    OPERATOR_LOCAL_INSTRUCTION,
+    UNARY_OPERATOR_INSTRUCTION,
+    JUMP_INSTRUCTION,
+    JUMP_IF_FALSE_INSTRUCTION,
+    JUMP_IF_TRUE_INSTRUCTION,
+    LOOP_INSTRUCTION,
+    LAMBDA_INSTRUCTION,
+    BLOCK_INSTRUCTION,
+    SAVE_ENV_INSTRUCTION,
+    RESTORE_ENV_INSTRUCTION,
+    CALL_INSTRUCTION,
+    TAIL_CALL_INSTRUCTION,
+    CALL_GLOBAL_INSTRUCTION,
+    TAIL_CALL_GLOBAL_INSTRUCTION,
+    RETURN_INSTRUCTION,
+    RETURN_UNDEFINED_INSTRUCTION,
+    HALT_INSTRUCTION
+};
+
+/*
+ * An instruction is its opcode, or the address of its code in run when
+ * threaded, followed by its operands.
+ */
+typedef union vm_word_tag {
+    void *label;
+    long operand;
+    double number;
+} vm_word;
+
+#define INITIAL_CODE_SIZE 4096
+#define INITIAL_TABLE_SIZE 256
+#define UNDEFINED_CONSTANT 0
+
+static vm_word *code = NULL;
+static long code_count = 0;
+static long code_size = 0;
+#ifdef VM_THREADED
+static void **opcode_labels = NULL;
+#endif
+
+/*
+ * Heap cells referred to by the code.  A slot of globals holds the name
+ * until the binding is first looked up and the binding afterwards.
+ */
+static cell constants;
+static int constants_count = 0;
+static cell globals;
+static int globals_count = 0;
+static cell vm_function_tag;
+static cell cont_tag;
+static cell esc_tag;
+
+static cell make_vm_function(long entry, cell parameters, cons *env) {
+    return pair(vm_function_tag,
+                pair(parameters,
+                     pair(get_number(entry),
+                          pair(get_pointer(env),
+                               get_nil()))));
+}
+
+static int is_vm_function(cell c) {
+    return is_pair(c) && eq_symbol(head(c), vm_function_tag);
+}
+
+static cell vm_function_parameters(cell c) {
+    return head(tail(c));
+}
+
+static long vm_function_entry(cell c) {
+    return check_and_get_int(head(tail(tail(c))));
+}
+
+static cons *vm_function_environment(cell c) {
+    return CELL_POINTER(head(tail(tail(tail(c)))));
+}
+
+static int is_continuation(cell c) {
+    return is_pair(c) && eq_symbol(head(c), cont_tag);
+}
+
+static int is_escape(cell c) {
+    return is_pair(c) && eq_symbol(head(c), esc_tag);
+}
+
+static cell grow_table(cell table, int count) {
+    cell result;
+    int i;
+
+    if(count < vector_length(table)) {
+        return table;
+    }
+    result = make_vector(TABLE_VECTOR, vector_length(table) * 2);
+    for(i = 0; i < count; i++) {
+        vector_set(result, i, vector_ref(table, i));
+    }
+    return result;
+}
+
+static int add_constant(cell value) {
+    constants = grow_table(constants, constants_count);
+    vector_set(constants, constants_count, value);
+    return constants_count++;
+}
+
+static int global_index(cell symbol, int index) {
+    cell slot;
+
+    if(index >= globals_count) {
+        globals = grow_table(globals, globals_count);
+        vector_set(globals, globals_count, symbol);
+        return globals_count++;
+    }
+    slot = vector_ref(globals, index);
+    return eq_symbol(is_pair(slot) ? head(slot) : slot, symbol) ? index : global_index(symbol, index + 1);
+}
+
+static cell global_binding_at(long index) {
+    cell slot = vector_ref(globals, index);
+
+    if(!is_pair(slot)) {
+        slot = lookup_global_binding(slot, env);
+        vector_set(globals, index, slot);
+    }
+    return slot;
+}
+
+static long emit_word(vm_word word) {
+    if(code_count >= code_size) {
+        code_size = code_size == 0 ? INITIAL_CODE_SIZE : code_size * 2;
+        code = realloc(code, code_size * sizeof(vm_word));
+        if(code == NULL) {
+            PUT_ERROR("Out of memory -- emit_word", get_nil());
+        }
+    }
+    code[code_count] = word;
+    return code_count++;
+}
+
+static long emit_operand(long operand) {
+    vm_word word;
+
+    word.operand = operand;
+    return emit_word(word);
+}
+
+static long emit_number(double number) {
+    vm_word word;
+
+    word.number = number;
+    return emit_word(word);
+}
+
+static long emit_opcode(enum vm_opcode opcode) {
+#ifdef VM_THREADED
+    vm_word word;
+
+    word.label = opcode_labels[opcode];
+    return emit_word(word);
+#else
+    return emit_operand(opcode);
+#endif
+}
+
+static void patch_jump(long operand) {
+    code[operand].operand = code_count;
+}
+
+/*
+ * The jumps of the breaks and the continues in the loop being compiled
+ * are chained through their operands until the loop patches them, and
+ * loop_blocks counts the environments saved by blocks since the loop
+ * began, which a break or a continue gives back.
+ */
+static long break_jumps = -1;
+static long continue_jumps = -1;
+static int loop_blocks = 0;
+
+static void patch_jumps(long chain) {
+    long rest;
+
+    for(; chain >= 0; chain = rest) {
+        rest = code[chain].operand;
+        code[chain].operand = code_count;
+    }
+}
+
+static enum node_kind node_kind(cell node) {
+    return vector_kind(node);
+}
+
+static int is_number_literal(cell node) {
+    return node_kind(node) == LITERAL_NODE && CELL_TYPE(vector_ref(node, 0)) == NUMBER;
+}
+
+static int is_local_name(cell node) {
+    return node_kind(node) == NAME_NODE && check_and_get_int(vector_ref(node, 1)) >= 0;
+}
+
+static int is_global_name(cell node) {
+    return node_kind(node) == NAME_NODE && check_and_get_int(vector_ref(node, 1)) < 0;
+}
+
+/*
+ * An inert expression neither fails nor has effects, so it may be
+ * evaluated before the function it is passed to.
+ */
+static int are_inert(cell nodes) {
+    return is_null(nodes)
+           ? TRUE
+           : (node_kind(head(nodes)) == LITERAL_NODE || is_local_name(head(nodes))) && are_inert(tail(nodes));
+}
+
+static int list_length(cell list) {
+    return is_null(list) ? 0 : 1 + list_length(tail(list));
+}
+
+static void emit_address(enum vm_opcode opcode, cell node) {
+    emit_opcode(opcode);
+    emit_operand(check_and_get_int(vector_ref(node, 1)));
+    emit_operand(check_and_get_int(vector_ref(node, 2)));
+}
+
+static void emit_global(enum vm_opcode opcode, cell node) {
+    emit_opcode(opcode);
+    emit_operand(global_index(vector_ref(node, 0), 0));
+}
+
+static void compile(cell node, int is_tail);
+
+static void compile_undefined() {
+    emit_opcode(CONSTANT_INSTRUCTION);
+    emit_operand(UNDEFINED_CONSTANT);
+}
+
+static void compile_literal(cell value) {
+    if(CELL_TYPE(value) == NUMBER) {
+        emit_opcode(NUMBER_INSTRUCTION);
+        emit_number(CELL_NUMBER(value));
+    } else {
+        emit_opcode(CONSTANT_INSTRUCTION);
+        emit_operand(add_constant(value));
+    }
+}
+
+static void compile_push(cell node) {
+    if(is_number_literal(node)) {
+        emit_opcode(PUSH_NUMBER_INSTRUCTION);
+        emit_number(CELL_NUMBER(vector_ref(node, 0)));
+    } else if(node_kind(node) == LITERAL_NODE) {
+        emit_opcode(PUSH_CONSTANT_INSTRUCTION);
+        emit_operand(add_constant(vector_ref(node, 0)));
+    } else if(is_local_name(node)) {
+        emit_address(PUSH_LOCAL_INSTRUCTION, node);
+    } else if(is_global_name(node)) {
+        emit_global(PUSH_GLOBAL_INSTRUCTION, node);
+    } else {
+        compile(node, FALSE);
+        emit_opcode(PUSH_INSTRUCTION);
+    }
+}
+
+static void compile_name(cell node) {
+    if(is_local_name(node)) {
+        emit_address(LOCAL_INSTRUCTION, node);
+    } else {
+        emit_global(GLOBAL_INSTRUCTION, node);
+    }
+}
+
+static void compile_application(cell node, int is_tail) {
+    cell function = vector_ref(node, 0);
+    cell operands = vector_ref(node, 1);
+    int count = list_length(operands);
+
+    if(is_global_name(function) && are_inert(operands)) {
+        for(; !is_null(operands); operands = tail(operands)) {
+            compile_push(head(operands));
+        }
+        emit_global(is_tail ? TAIL_CALL_GLOBAL_INSTRUCTION : CALL_GLOBAL_INSTRUCTION, function);
+    } else {
+        compile_push(function);
+        for(; !is_null(operands); operands = tail(operands)) {
+            compile_push(head(operands));
+        }
+        emit_opcode(is_tail ? TAIL_CALL_INSTRUCTION : CALL_INSTRUCTION);
+    }
+    emit_operand(count);
+}
+
+static void compile_logical(cell node, int is_tail, enum vm_opcode jump) {
+    long skip;
+
+    compile(vector_ref(node, 0), FALSE);
+    emit_opcode(jump);
+    skip = emit_operand(0);
+    compile(vector_ref(node, 1), is_tail);
+    patch_jump(skip);
+}
+
+static void compile_conditional(cell node, int is_tail) {
+    long alternative;
+    long after;
+
+    compile(vector_ref(node, 0), FALSE);
+    emit_opcode(JUMP_IF_FALSE_INSTRUCTION);
+    alternative = emit_operand(0);
+    compile(vector_ref(node, 1), is_tail);
+    emit_opcode(JUMP_INSTRUCTION);
+    after = emit_operand(0);
+    patch_jump(alternative);
+    compile(vector_ref(node, 2), is_tail);
+    patch_jump(after);
+}
+
+static void compile_function_body(cell body) {
+    if(node_kind(body) == BLOCK_NODE) {
+        emit_opcode(BLOCK_INSTRUCTION);
+        emit_operand(add_constant(vector_ref(body, 0)));
+        compile(vector_ref(body, 1), FALSE);
+    } else {
+        compile(body, FALSE);
+    }
+    emit_opcode(RETURN_UNDEFINED_INSTRUCTION);
+}
+
+static void compile_lambda(cell node) {
+    long after;
+    long entry;
+
+    emit_opcode(JUMP_INSTRUCTION);
+    after = emit_operand(0);
+    entry = code_count;
+    compile_function_body(vector_ref(node, 1));
+    patch_jump(after);
+    emit_opcode(LAMBDA_INSTRUCTION);
+    emit_operand(entry);
+    emit_operand(add_constant(vector_ref(node, 0)));
+}
+
+static void compile_sequence(cell statements) {
+    if(is_null(statements)) {
+        compile_undefined();
+    }
+    for(; !is_null(statements); statements = tail(statements)) {
+        compile(head(statements), FALSE);
+    }
+}
+
+/*
+ * A block inside a function body gives the environment back when it is
+ * left, as ev_block's caller does in engine.c.
+ */
+static void compile_block(cell node) {
+    emit_opcode(SAVE_ENV_INSTRUCTION);
+    emit_opcode(BLOCK_INSTRUCTION);
+    emit_operand(add_constant(vector_ref(node, 0)));
+    loop_blocks++;
+    compile(vector_ref(node, 1), FALSE);
+    loop_blocks--;
+    emit_opcode(RESTORE_ENV_INSTRUCTION);
+}
+
+/*
+ * A loop is a test at its top and a jump back to it, so its iterations
+ * take no stack and no frames.
+ */
+static void compile_loop(cell node) {
+    long outer_breaks = break_jumps;
+    long outer_continues = continue_jumps;
+    int outer_blocks = loop_blocks;
+    long test = code_count;
+    long exit;
+
+    compile(vector_ref(node, 0), FALSE);
+    emit_opcode(JUMP_IF_FALSE_INSTRUCTION);
+    exit = emit_operand(0);
+    break_jumps = -1;
+    continue_jumps = -1;
+    loop_blocks = 0;
+    compile(vector_ref(node, 1), FALSE);
+    patch_jumps(continue_jumps);
+    if(!is_null(vector_ref(node, 2))) {
+        compile(vector_ref(node, 2), FALSE);
+    }
+    emit_opcode(LOOP_INSTRUCTION);
+    emit_operand(test);
+    patch_jump(exit);
+    patch_jumps(break_jumps);
+    compile_undefined();
+    break_jumps = outer_breaks;
+    continue_jumps = outer_continues;
+    loop_blocks = outer_blocks;
+}
+
+static void compile_loop_exit(long *jumps) {
+    int i;
+
+    for(i = 0; i < loop_blocks; i++) {
+        emit_opcode(RESTORE_ENV_INSTRUCTION);
+    }
+    emit_opcode(JUMP_INSTRUCTION);
+    *jumps = emit_operand(*jumps);
+}
+
+static void compile_definition(cell node, int is_declaration) {
+    compile(vector_ref(node, 3), FALSE);
+    if(check_and_get_int(vector_ref(node, 1)) >= 0) {
+        emit_address(SET_LOCAL_INSTRUCTION, node);
+    } else {
+        emit_global(SET_GLOBAL_INSTRUCTION, node);
+    }
+    if(is_declaration) {
+        compile_undefined();
+    }
+}
+
+static void compile_operator(cell node) {
+    enum operator_code op = check_and_get_int(vector_ref(node, 1));
+    cell second;
+
+    compile(vector_ref(node, 2), FALSE);
+    if(vector_length(node) == 3) {
+        emit_opcode(UNARY_OPERATOR_INSTRUCTION);
+        emit_operand(op);
+        return;
+    }
+    second = vector_ref(node, 3);
+    if(is_number_literal(second)) {
+        emit_opcode(OPERATOR_NUMBER_INSTRUCTION);
+        emit_operand(op);
+        emit_number(CELL_NUMBER(vector_ref(second, 0)));
+    } else if(is_local_name(second)) {
+        emit_opcode(OPERATOR_LOCAL_INSTRUCTION);
+        emit_operand(op);
+        emit_operand(check_and_get_int(vector_ref(second, 1)));
+        emit_operand(check_and_get_int(vector_ref(second, 2)));
+    } else {
+        emit_opcode(PUSH_INSTRUCTION);
+        compile(second, FALSE);
+        emit_opcode(OPERATOR_INSTRUCTION);
+        emit_operand(op);
+    }
+}
+
+/*
+ * is_tail is TRUE when the value of the node is returned from the function.
+ */
+static void compile(cell node, int is_tail) {
+    enum node_kind kind = node_kind(node);
+
+    if(kind == LITERAL_NODE) {
+        compile_literal(vector_ref(node, 0));
+    } else if(kind == NAME_NODE) {
+        compile_name(node);
+    } else if(kind == APPLICATION_NODE) {
+        compile_application(node, is_tail);
+    } else if(kind == AND_NODE) {
+        compile_logical(node, is_tail, JUMP_IF_FALSE_INSTRUCTION);
+    } else if(kind == OR_NODE) {
+        compile_logical(node, is_tail, JUMP_IF_TRUE_INSTRUCTION);
+    } else if(kind == CONDITIONAL_NODE) {
+        compile_conditional(node, is_tail);
+    } else if(kind == LAMBDA_NODE) {
+        compile_lambda(node);
+    } else if(kind == SEQUENCE_NODE) {
+        compile_sequence(vector_ref(node, 0));
+    } else if(kind == BLOCK_NODE) {
+        compile_block(node);
+    } else if(kind == RETURN_NODE) {
+        compile(vector_ref(node, 0), TRUE);
+        emit_opcode(RETURN_INSTRUCTION);
+    } else if(kind == DECLARATION_NODE) {
+        compile_definition(node, TRUE);
+    } else if(kind == ASSIGNMENT_NODE) {
+        compile_definition(node, FALSE);
+    } else if(kind == OPERATOR_NODE) {
+        compile_operator(node);
+    } else if(kind == LOOP_NODE) {
+        compile_loop(node);
+    } else if(kind == BREAK_NODE) {
+        compile_loop_exit(&break_jumps);
+    } else if(kind == CONTINUE_NODE) {
+        compile_loop_exit(&continue_jumps);
+    } else {
+        PUT_ERROR("Unknown node -- compile", node);
+    }
+}
+
+static long compile_vm_program(cell program) {
+    long entry = code_count;
+
+    break_jumps = -1;
+    continue_jumps = -1;
+    loop_blocks = 0;
+    compile(analyze_program(program), FALSE);
+    emit_opcode(HALT_INSTRUCTION);
+    return entry;
+}
+
+/*
+ * Pops the return address and the environment of the caller once the
+ * stack has been reverted to the marker of the frame.
+ */
+static vm_word *return_to_caller() {
+    long address = check_and_get_int(restore());
+
+    env = restore_cons();
+    return code + address;
+}
+
+static vm_word *return_from_function() {
+    revert_stack_to_marker();
+    return return_to_caller();
+}
+
+/*
+ * Applies fun to the count arguments on top of the stack after dropping
+ * the rest of the drop cells with them, and answers where to go on.
+ */
+static vm_word *apply(vm_word *pc, int count, int drop, int is_tail) {
+    cell value;
+    cons *environment;
+
+    if(is_primitive_function(fun)) {
+        val = apply_primitive_function(fun, count, stack_arguments(count));
+        drop_stack(drop);
+        return is_tail ? return_from_function() : pc;
+    } else if(is_vm_function(fun)) {
+        environment = extend_environment_arguments(vm_function_parameters(fun), count, stack_arguments(count),
+                                                   vm_function_environment(fun));
+        drop_stack(drop);
+        if(is_tail) {
+            drop_stack_to_marker();
+        } else {
+            save_cons(env);
+            save(get_number(pc - code));
+            push_marker_to_stack();
+        }
+        env = environment;
+        return code + vm_function_entry(fun);
+    } else if(is_continuation(fun)) {
+        value = count > 0 ? stack_arguments(count)[0] : get_undefined();
+        restore_registers(check_and_get_cons_ptr(head(tail(fun))));
+        val = value;
+        return return_from_function();
+    } else if(is_escape(fun)) {
+        value = count > 0 ? stack_arguments(count)[0] : get_undefined();
+        revert_stack_to_escape(fun);
+        val = value;
+        return return_to_caller();
+    } else {
+        PUT_ERROR("Internal error -- apply", get_nil());
+    }
+}
+
+#ifdef VM_THREADED
+#define INSTRUCTION(opcode) opcode:
+#define NEXT_INSTRUCTION goto *(pc++)->label
+#define START_DISPATCH NEXT_INSTRUCTION;
+#define END_DISPATCH
+#else
+#define INSTRUCTION(opcode) case opcode:
+#define NEXT_INSTRUCTION continue
+#define START_DISPATCH for(;;) switch((pc++)->operand) {
+#define END_DISPATCH }
+#endif
+
+/*
+ * Runs the code from entry up to HALT.  When threaded, a negative entry
+ * only hands the addresses of the instructions to the compiler.
+ */
+static void run(long entry) {
+#ifdef VM_THREADED
+    static void *labels[] = {
+        &&CONSTANT_INSTRUCTION,
+        &&NUMBER_INSTRUCTION,
+        &&LOCAL_INSTRUCTION,
+        &&GLOBAL_INSTRUCTION,
+        &&PUSH_INSTRUCTION,
+        &&PUSH_CONSTANT_INSTRUCTION,
+        &&PUSH_NUMBER_INSTRUCTION,
+        &&PUSH_LOCAL_INSTRUCTION,
+        &&PUSH_GLOBAL_INSTRUCTION,
+        &&SET_LOCAL_INSTRUCTION,
+        &&SET_GLOBAL_INSTRUCTION,
+        &&OPERATOR_INSTRUCTION,
+        &&OPERATOR_NUMBER_INSTRUCTION,
+        &&OPERATOR_LOCAL_INSTRUCTION,
+        &&UNARY_OPERATOR_INSTRUCTION,
+        &&JUMP_INSTRUCTION,
+        &&JUMP_IF_FALSE_INSTRUCTION,
+        &&JUMP_IF_TRUE_INSTRUCTION,
+        &&LOOP_INSTRUCTION,
+        &&LAMBDA_INSTRUCTION,
+        &&BLOCK_INSTRUCTION,
+        &&SAVE_ENV_INSTRUCTION,
+        &&RESTORE_ENV_INSTRUCTION,
+        &&CALL_INSTRUCTION,
+        &&TAIL_CALL_INSTRUCTION,
+        &&CALL_GLOBAL_INSTRUCTION,
+        &&TAIL_CALL_GLOBAL_INSTRUCTION,
+        &&RETURN_INSTRUCTION,
+        &&RETURN_UNDEFINED_INSTRUCTION,
+        &&HALT_INSTRUCTION
+    };
+#endif
+    vm_word *pc;
+    int count;
+
+#ifdef VM_THREADED
+    if(entry < 0) {
+        opcode_labels = labels;
+        return;
+    }
+#endif
+    pc = code + entry;
+    START_DISPATCH
+    INSTRUCTION(CONSTANT_INSTRUCTION)
+        val = vector_ref(constants, pc[0].operand);
+        pc += 1;
+        NEXT_INSTRUCTION;
+    INSTRUCTION(NUMBER_INSTRUCTION)
+        val = get_number(pc[0].number);
+        pc += 1;
+        NEXT_INSTRUCTION;
+    INSTRUCTION(LOCAL_INSTRUCTION)
+        val = lookup_lexical_value(pc[0].operand, pc[1].operand, env);
+        pc += 2;
+        NEXT_INSTRUCTION;
+    INSTRUCTION(GLOBAL_INSTRUCTION)
+        val = tail(global_binding_at(pc[0].operand));
+        pc += 1;
+        NEXT_INSTRUCTION;
+    INSTRUCTION(PUSH_INSTRUCTION)
+        save(val);
+        NEXT_INSTRUCTION;
+    INSTRUCTION(PUSH_CONSTANT_INSTRUCTION)
+        save(vector_ref(constants, pc[0].operand));
+        pc += 1;
+        NEXT_INSTRUCTION;
+    INSTRUCTION(PUSH_NUMBER_INSTRUCTION)
+        save(get_number(pc[0].number));
+        pc += 1;
+        NEXT_INSTRUCTION;
+    INSTRUCTION(PUSH_LOCAL_INSTRUCTION)
+        save(lookup_lexical_value(pc[0].operand, pc[1].operand, env));
+        pc += 2;
+        NEXT_INSTRUCTION;
+    INSTRUCTION(PUSH_GLOBAL_INSTRUCTION)
+        save(tail(global_binding_at(pc[0].operand)));
+        pc += 1;
+        NEXT_INSTRUCTION;
+    INSTRUCTION(SET_LOCAL_INSTRUCTION)
+        assign_lexical_value(pc[0].operand, pc[1].operand, val, env);
+        pc += 2;
+        NEXT_INSTRUCTION;
+    INSTRUCTION(SET_GLOBAL_INSTRUCTION)
+        set_tail(global_binding_at(pc[0].operand), val);
+        pc += 1;
+        NEXT_INSTRUCTION;
+    INSTRUCTION(OPERATOR_INSTRUCTION)
+        val = operator_value(pc[0].operand, restore(), val);
+        pc += 1;
+        NEXT_INSTRUCTION;
+    INSTRUCTION(OPERATOR_NUMBER_INSTRUCTION)
+        val = operator_value(pc[0].operand, val, get_number(pc[1].number));
+        pc += 2;
+        NEXT_INSTRUCTION;
+    INSTRUCTION(OPERATOR_LOCAL_INSTRUCTION)
+        val = operator_value(pc[0].operand, val, lookup_lexical_value(pc[1].operand, pc[2].operand, env));
+        pc += 3;
+        NEXT_INSTRUCTION;
+    INSTRUCTION(UNARY_OPERATOR_INSTRUCTION)
+        val = unary_operator_value(pc[0].operand, val);
+        pc += 1;
+        NEXT_INSTRUCTION;
+    INSTRUCTION(JUMP_INSTRUCTION)
+        pc = code + pc[0].operand;
+        NEXT_INSTRUCTION;
+    INSTRUCTION(JUMP_IF_FALSE_INSTRUCTION)
+        pc = is_falsy(val) ? code + pc[0].operand : pc + 1;
+        NEXT_INSTRUCTION;
+    INSTRUCTION(JUMP_IF_TRUE_INSTRUCTION)
+        pc = is_falsy(val) ? pc + 1 : code + pc[0].operand;
+        NEXT_INSTRUCTION;
+    INSTRUCTION(LOOP_INSTRUCTION)
+        pc = code + pc[0].operand;
+        gc_collect_if_possible();
+        NEXT_INSTRUCTION;
+    INSTRUCTION(LAMBDA_INSTRUCTION)
+        val = make_vm_function(pc[0].operand, vector_ref(constants, pc[1].operand), env);
+        pc += 2;
+        gc_collect_if_possible();
+        NEXT_INSTRUCTION;
+    INSTRUCTION(BLOCK_INSTRUCTION)
+        env = extend_block_environment(vector_ref(constants, pc[0].operand), env);
+        pc += 1;
+        gc_collect_if_possible();
+        NEXT_INSTRUCTION;
+    INSTRUCTION(SAVE_ENV_INSTRUCTION)
+        save_cons(env);
+        NEXT_INSTRUCTION;
+    INSTRUCTION(RESTORE_ENV_INSTRUCTION)
+        env = restore_cons();
+        NEXT_INSTRUCTION;
+    INSTRUCTION(CALL_INSTRUCTION)
+        count = pc[0].operand;
+        fun = stack_arguments(count + 1)[0];
+        pc = apply(pc + 1, count, count + 1, FALSE);
+        gc_collect_if_possible();
+        NEXT_INSTRUCTION;
+    INSTRUCTION(TAIL_CALL_INSTRUCTION)
+        count = pc[0].operand;
+        fun = stack_arguments(count + 1)[0];
+        pc = apply(pc + 1, count, count + 1, TRUE);
+        gc_collect_if_possible();
+        NEXT_INSTRUCTION;
+    INSTRUCTION(CALL_GLOBAL_INSTRUCTION)
+        count = pc[1].operand;
+        fun = tail(global_binding_at(pc[0].operand));
+        pc = apply(pc + 2, count, count, FALSE);
+        gc_collect_if_possible();
+        NEXT_INSTRUCTION;
+    INSTRUCTION(TAIL_CALL_GLOBAL_INSTRUCTION)
+        count = pc[1].operand;
+        fun = tail(global_binding_at(pc[0].operand));
+        pc = apply(pc + 2, count, count, TRUE);
+        gc_collect_if_possible();
+        NEXT_INSTRUCTION;
+    INSTRUCTION(RETURN_INSTRUCTION)
+        pc = return_from_function();
+        NEXT_INSTRUCTION;
+    INSTRUCTION(RETURN_UNDEFINED_INSTRUCTION)
+        val = get_undefined();
+        pc = return_from_function();
+        NEXT_INSTRUCTION;
+    INSTRUCTION(HALT_INSTRUCTION)
+        return;
+    END_DISPATCH
+}
+
+/*
+ * Compiled programs may be kept in a cache directory, in files named by a
+ * hash of their source.  A file holds the source, the code with its jumps
+ * relative to its start and its constants and globals numbered in its own
+ * tables, and those tables as data.  Loading maps the file and translates
+ * the code into the code array without parsing the source again.  A hash
+ * of everything after the header finds files which have been damaged.
+ */
+#define VM_CACHE_MAGIC "SICPVMC"
+#define VM_CACHE_VERSION 3
+
+typedef struct vm_cache_header_tag {
+    char magic[8];
+    long version;
+    long source_length;
+    long code_count;
+    long data_size;
+    unsigned long checksum;
+} vm_cache_header;
+
+typedef struct byte_buffer_tag {
+    unsigned char *bytes;
+    long count;
+    long size;
+} byte_buffer;
+
+typedef struct byte_reader_tag {
+    unsigned char *next;
+    unsigned char *end;
+} byte_reader;
+
+static char *cache_directory = NULL;
+
+/*
+ * The operands of each instruction, indexed by enum vm_opcode: a is a
+ * code address, k a constant, g a global, n a number and i an integer.
+ */
+static char *operand_kinds[] = {
+    "k", "n", "ii", "g", "", "k", "n", "ii", "g", "ii", "g", "i", "in", "iii", "i",
+    "a", "a", "a", "a", "ak", "k", "", "", "i", "i", "gi", "gi", "", "", ""
+};
+
+static long padded_length(long length) {
+    return (length + sizeof(vm_word) - 1) / sizeof(vm_word) * sizeof(vm_word);
+}
+
+static unsigned long bytes_hash(unsigned char *bytes, long count) {
+    unsigned long hash = 14695981039346656037UL;
+    long i;
+
+    for(i = 0; i < count; i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211UL;
+    }
+    return hash;
+}
+
+static unsigned long source_hash(char *source) {
+    return bytes_hash((unsigned char *)source, strlen(source));
+}
+
+static char *cache_path(char *program) {
+    char *path = malloc(strlen(cache_directory) + 32);
+
+    if(path == NULL) {
+        PUT_ERROR("Out of memory -- cache_path", get_nil());
+    }
+    sprintf(path, "%s/%016lx.vmc", cache_directory, source_hash(program));
+    return path;
+}
+
+static enum vm_opcode opcode_of(vm_word word) {
+#ifdef VM_THREADED
+    int opcode;
+
+    for(opcode = 0; opcode_labels[opcode] != word.label; opcode++);
+    return opcode;
+#else
+    return word.operand;
+#endif
+}
+
+static void put_bytes(byte_buffer *buffer, void *bytes, long count) {
+    if(buffer->count + count > buffer->size) {
+        buffer->size = (buffer->count + count) * 2;
+        buffer->bytes = realloc(buffer->bytes, buffer->size);
+        if(buffer->bytes == NULL) {
+            PUT_ERROR("Out of memory -- put_bytes", get_nil());
+        }
+    }
+    memcpy(buffer->bytes + buffer->count, bytes, count);
+    buffer->count += count;
+}
+
+static void put_tag(byte_buffer *buffer, char tag) {
+    put_bytes(buffer, &tag, 1);
+}
+
+static void put_chars(byte_buffer *buffer, char tag, cell c) {
+    symbol_view view = get_symbol_view(&c);
+
+    put_tag(buffer, tag);
+    put_bytes(buffer, &view.length, sizeof(long));
+    put_bytes(buffer, view.chars, view.length);
+}
+
+/*
+ * Constants are literal values and lists of names, so these are all the
+ * data a program has.
+ */
+static void put_datum(byte_buffer *buffer, cell c) {
+    double number;
+
+    for(; is_pair(c) && !is_string(c); c = tail(c)) {
+        put_tag(buffer, 'p');
+        put_datum(buffer, head(c));
+    }
+    if(is_null(c)) {
+        put_tag(buffer, 'n');
+    } else if(CELL_TYPE(c) == NUMBER) {
+        number = CELL_NUMBER(c);
+        put_tag(buffer, 'd');
+        put_bytes(buffer, &number, sizeof(double));
+    } else if(CELL_TYPE(c) == TRUE_LITERAL) {
+        put_tag(buffer, 't');
+    } else if(CELL_TYPE(c) == FALSE_LITERAL) {
+        put_tag(buffer, 'f');
+    } else if(CELL_TYPE(c) == UNDEFINED) {
+        put_tag(buffer, 'u');
+    } else if(CELL_TYPE(c) == SYMBOL || CELL_TYPE(c) == SHORT_SYMBOL) {
+        put_chars(buffer, 'y', c);
+    } else if(is_string(c)) {
+        put_chars(buffer, 's', c);
+    } else {
+        PUT_ERROR("Internal error -- put_datum", c);
+    }
+}
+
+static int get_bytes(byte_reader *reader, void *bytes, long count) {
+    if(count < 0 || reader->end - reader->next < count) {
+        return FALSE;
+    }
+    memcpy(bytes, reader->next, count);
+    reader->next += count;
+    return TRUE;
+}
+
+static int get_chars(byte_reader *reader, cell *result, cell (*make)(char *, int)) {
+    long length;
+
+    if(!get_bytes(reader, &length, sizeof(long)) || length < 0 || reader->end - reader->next < length) {
+        return FALSE;
+    }
+    *result = make((char *)reader->next, length);
+    reader->next += length;
+    return TRUE;
+}
+
+static int get_datum(byte_reader *reader, cell *result) {
+    cell last = get_nil();
+    cell element;
+    cell atom;
+    char tag;
+    double number;
+
+    for(;;) {
+        if(!get_bytes(reader, &tag, 1)) {
+            return FALSE;
+        } else if(tag != 'p') {
+            break;
+        } else if(!get_datum(reader, &element)) {
+            return FALSE;
+        }
+        element = pair(element, get_nil());
+        if(is_null(last)) {
+            *result = element;
+        } else {
+            set_tail(last, element);
+        }
+        last = element;
+    }
+    if(tag == 'n') {
+        atom = get_nil();
+    } else if(tag == 'd') {
+        if(!get_bytes(reader, &number, sizeof(double))) {
+            return FALSE;
+        }
+        atom = get_number(number);
+    } else if(tag == 't') {
+        atom = get_true();
+    } else if(tag == 'f') {
+        atom = get_false();
+    } else if(tag == 'u') {
+        atom = get_undefined();
+    } else if(tag == 'y' || tag == 's') {
+        if(!get_chars(reader, &atom, tag == 'y' ? get_symbol : get_string)) {
+            return FALSE;
+        }
+    } else {
+        return FALSE;
+    }
+    if(is_null(last)) {
+        *result = atom;
+    } else {
+        set_tail(last, atom);
+    }
+    return TRUE;
+}
+
+static cell table_list(cell table, int from, int to) {
+    cell result = get_nil();
+
+    while(to > from) {
+        result = pair(vector_ref(table, --to), result);
+    }
+    return result;
+}
+
+static cell global_names() {
+    cell result = get_nil();
+    cell slot;
+    int i;
+
+    for(i = globals_count - 1; i >= 0; i--) {
+        slot = vector_ref(globals, i);
+        result = pair(is_pair(slot) ? head(slot) : slot, result);
+    }
+    return result;
+}
+
+static void put_code(byte_buffer *buffer, long entry, int constants_base) {
+    vm_word word;
+    enum vm_opcode opcode;
+    char *kind;
+    long i;
+
+    for(i = entry; i < code_count; ) {
+        opcode = opcode_of(code[i++]);
+        word.operand = opcode;
+        put_bytes(buffer, &word, sizeof(vm_word));
+        for(kind = operand_kinds[opcode]; *kind != '\0'; kind++) {
+            word = code[i++];
+            if(*kind == 'a') {
+                word.operand -= entry;
+            } else if(*kind == 'k') {
+                word.operand = word.operand == UNDEFINED_CONSTANT ? 0 : word.operand - constants_base + 1;
+            }
+            put_bytes(buffer, &word, sizeof(vm_word));
+        }
+    }
+}
+
+/*
+ * The file is written under a temporary name and renamed, so a reader
+ * never maps a half written one.  A cache which cannot be written is
+ * only not used.
+ */
+static void store_program(char *program, long entry, int constants_base, cell declarations) {
+    byte_buffer buffer = { NULL, 0, 0 };
+    byte_buffer data = { NULL, 0, 0 };
+    vm_cache_header header;
+    long padding = 0;
+    char *path = cache_path(program);
+    char *temporary = malloc(strlen(path) + 32);
+    FILE *out;
+
+    memset(&header, 0, sizeof(header));
+    strcpy(header.magic, VM_CACHE_MAGIC);
+    header.version = VM_CACHE_VERSION;
+    header.source_length = strlen(program);
+    header.code_count = code_count - entry;
+    put_datum(&data, declarations);
+    put_datum(&data, global_names());
+    put_datum(&data, table_list(constants, constants_base, constants_count));
+    header.data_size = data.count;
+    put_bytes(&buffer, &header, sizeof(header));
+    put_bytes(&buffer, program, header.source_length);
+    put_bytes(&buffer, &padding, padded_length(header.source_length) - header.source_length);
+    put_code(&buffer, entry, constants_base);
+    put_bytes(&buffer, data.bytes, data.count);
+    ((vm_cache_header *)buffer.bytes)->checksum = bytes_hash(buffer.bytes + sizeof(header), buffer.count - sizeof(header));
+    sprintf(temporary, "%s.%ld", path, (long)getpid());
+    out = fopen(temporary, "wb");
+    if(out != NULL) {
+        if(fwrite(buffer.bytes, 1, buffer.count, out) == (size_t)buffer.count && fclose(out) == 0) {
+            rename(temporary, path);
+        } else {
+            remove(temporary);
+        }
+    }
+    free(buffer.bytes);
+    free(data.bytes);
+    free(temporary);
+    free(path);
+}
+
+/*
+ * Marks where the instructions of the code start, so that a jump into
+ * the middle of one is refused, and answers whether the opcodes are known
+ * and the last instruction is whole.
+ */
+static int find_instructions(vm_word *words, long count, char *starts) {
+    long i = 0;
+
+    while(i < count && words[i].operand >= 0 && words[i].operand <= HALT_INSTRUCTION) {
+        starts[i] = TRUE;
+        i += 1 + strlen(operand_kinds[words[i].operand]);
+    }
+    return i == count;
+}
+
+static int translate_code(vm_word *words, long count, char *starts, int *global_map, int globals_length,
+                          int constants_length) {
+    long entry = code_count;
+    int constants_base = constants_count - constants_length;
+    enum vm_opcode opcode;
+    vm_word word;
+    char *kind;
+    long i;
+
+    for(i = 0; i < count; ) {
+        if(words[i].operand < 0 || words[i].operand > HALT_INSTRUCTION) {
+            return FALSE;
+        }
+        opcode = words[i++].operand;
+        emit_opcode(opcode);
+        for(kind = operand_kinds[opcode]; *kind != '\0'; kind++) {
+            if(i >= count) {
+                return FALSE;
+            }
+            word = words[i++];
+            if(*kind == 'a' && word.operand >= 0 && word.operand < count && starts[word.operand]) {
+                emit_operand(entry + word.operand);
+            } else if(*kind == 'k' && word.operand >= 0 && word.operand <= constants_length) {
+                emit_operand(word.operand == 0 ? UNDEFINED_CONSTANT : constants_base + word.operand - 1);
+            } else if(*kind == 'g' && word.operand >= 0 && word.operand < globals_length) {
+                emit_operand(global_map[word.operand]);
+            } else if(*kind == 'n' || *kind == 'i') {
+                emit_word(word);
+            } else {
+                return FALSE;
+            }
+        }
+    }
+    return TRUE;
+}
+
+/*
+ * Answers the entry of the cached program, or -1 when the file does not
+ * hold this very program.
+ */
+static long read_cached_program(unsigned char *bytes, long size, char *program) {
+    vm_cache_header *header = (vm_cache_header *)bytes;
+    long code_offset = sizeof(vm_cache_header) + padded_length(header->source_length);
+    long entry = code_count;
+    int constants_base = constants_count;
+    byte_reader reader;
+    cell declarations;
+    cell names;
+    cell values;
+    int *global_map;
+    char *starts;
+    int globals_length;
+    int ok;
+
+    if(memcmp(header->magic, VM_CACHE_MAGIC, sizeof(header->magic)) != 0
+       || header->version != VM_CACHE_VERSION
+       || header->source_length != (long)strlen(program)
+       || header->code_count < 0 || header->data_size < 0
+       || code_offset + header->code_count * (long)sizeof(vm_word) + header->data_size != size
+       || header->checksum != bytes_hash(bytes + sizeof(vm_cache_header), size - sizeof(vm_cache_header))
+       || memcmp(bytes + sizeof(vm_cache_header), program, header->source_length) != 0) {
+        return -1;
+    }
+    reader.next = bytes + code_offset + header->code_count * sizeof(vm_word);
+    reader.end = bytes + size;
+    if(!get_datum(&reader, &declarations) || !get_datum(&reader, &names) || !get_datum(&reader, &values)) {
+        return -1;
+    }
+    global_map = malloc((list_length(names) + 1) * sizeof(int));
+    starts = calloc(header->code_count + 1, 1);
+    if(global_map == NULL || starts == NULL) {
+        PUT_ERROR("Out of memory -- read_cached_program", get_nil());
+    }
+    for(globals_length = 0; is_pair(names); names = tail(names)) {
+        global_map[globals_length++] = global_index(head(names), 0);
+    }
+    for(; is_pair(values); values = tail(values)) {
+        add_constant(head(values));
+    }
+    ok = find_instructions((vm_word *)(bytes + code_offset), header->code_count, starts)
+         && translate_code((vm_word *)(bytes + code_offset), header->code_count, starts, global_map,
+                           globals_length, constants_count - constants_base);
+    free(global_map);
+    free(starts);
+    if(!ok) {
+        code_count = entry;
+        constants_count = constants_base;
+        return -1;
+    }
+    define_unassigned(declarations, env);
+    return entry;
+}
+
+static long load_cached_program(char *program) {
+    char *path = cache_path(program);
+    int fd = open(path, O_RDONLY);
+    struct stat status;
+    void *bytes;
+    long entry = -1;
+
+    free(path);
+    if(fd < 0) {
+        return -1;
+    }
+    if(fstat(fd, &status) == 0 && status.st_size >= (off_t)sizeof(vm_cache_header)) {
+        bytes = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(bytes != MAP_FAILED) {
+            entry = read_cached_program(bytes, status.st_size, program);
+            munmap(bytes, status.st_size);
+        }
+    }
+    close(fd);
+    return entry;
+}
+
+extern void set_vm_cache(char *directory) {
+    cache_directory = directory;
+}
+
+static cell push_constants() {
+    return constants;
+}
+
+static void relocate_constants(cell c) {
+    constants = c;
+}
+
+static cell push_globals() {
+    return globals;
+}
+
+static void relocate_globals(cell c) {
+    globals = c;
+}
+
+/*
+ * The names a program declares are defined before it runs, as
+ * execute_machine does in engine.c.
+ */
+static long prepare_program(cell program) {
+    define_unassigned(program_declarations(program), env);
+    return compile_vm_program(program);
+}
+
+extern cell execute_vm(char *program) {
+    long entry = cache_directory != NULL ? load_cached_program(program) : -1;
+    int constants_base = constants_count;
+    cell parsed;
+
+    if(entry < 0) {
+        parsed = parse_js_bison(program);
+        if(is_null(parsed)) {
+            return parsed;
+        }
+        entry = prepare_program(parsed);
+        if(cache_directory != NULL) {
+            store_program(program, entry, constants_base, program_declarations(parsed));
+        }
+    }
+    run(entry);
+    return val;
+}
+
+/*
+ * call_cc is compiled again here so that it is a function of this engine.
+ */
+extern void init_vm() {
+    vm_function_tag = get_permanent_symbol("vm_function");
+    cont_tag = get_permanent_symbol("%cont");
+    esc_tag = get_permanent_symbol("%esc");
+    constants = make_vector(TABLE_VECTOR, INITIAL_TABLE_SIZE);
+    globals = make_vector(TABLE_VECTOR, INITIAL_TABLE_SIZE);
+    add_register(push_constants, relocate_constants);
+    add_register(push_globals, relocate_globals);
+    add_constant(get_undefined());
+#ifdef VM_THREADED
+    run(-1);
+#endif
+    run(prepare_program(call_cc_program()));
+}